@@ -1,129 +1,3132 @@
 #include <iostream>
 #include <fstream>
 #include <sstream>
-#include <set>
 #include <string>
+#include <string_view>
 #include <iomanip>
 #include <regex>
+#include <algorithm>
+#include <vector>
+#include <array>
+#include <unordered_map>
+#include <cstdint>
+#include <cctype>
+#include <cstdio>
+#include <cstdlib>
+#include <thread>
+#include <future>
+#include <mutex>
+#include <condition_variable>
+#include <queue>
+#include <functional>
+#include <memory>
+#include <deque>
+#include <cstring>
+#include <chrono>
+#include <stdexcept>
+#include <limits>
+#include <filesystem>
+#include <iterator>
+#include <random>
+#include <atomic>
 
-struct Message {
-    std::string user;
-    std::string time;
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// Timestamps are stored as milliseconds since 1970-01-01T00:00:00.000; no time zone is applied
+
+int64_t daysFromCivil(int64_t year, unsigned month, unsigned day) {
+    year -= month <= 2;
+    const int64_t era = (year >= 0 ? year : year - 399) / 400;
+    const unsigned yearOfEra = static_cast<unsigned>(year - era * 400);
+    const unsigned dayOfYear = (153 * (month > 2 ? month - 3 : month + 9) + 2) / 5 + day - 1;
+    const unsigned dayOfEra = yearOfEra * 365 + yearOfEra / 4 - yearOfEra / 100 + dayOfYear;
+    return era * 146097 + static_cast<int64_t>(dayOfEra) - 719468;
+}
+
+void civilFromDays(int64_t days, int64_t& year, unsigned& month, unsigned& day) {
+    days += 719468;
+    const int64_t era = (days >= 0 ? days : days - 146096) / 146097;
+    const unsigned dayOfEra = static_cast<unsigned>(days - era * 146097);
+    const unsigned yearOfEra = (dayOfEra - dayOfEra / 1460 + dayOfEra / 36524 - dayOfEra / 146096) / 365;
+    const unsigned dayOfYear = dayOfEra - (365 * yearOfEra + yearOfEra / 4 - yearOfEra / 100);
+    const unsigned monthIndex = (5 * dayOfYear + 2) / 153;
+    day = dayOfYear - (153 * monthIndex + 2) / 5 + 1;
+    month = monthIndex < 10 ? monthIndex + 3 : monthIndex - 9;
+    year = static_cast<int64_t>(yearOfEra) + era * 400 + (month <= 2);
+}
+
+// Parses YYYY-MM-DDTHH:MM:SS[.fff]; whitespace anywhere in the string is ignored
+bool parseTimestamp(std::string_view text, int64_t& result) {
+    char buffer[32];
+    size_t length = 0;
+    for (char c : text) {
+        if (std::isspace(static_cast<unsigned char>(c))) {
+            continue;
+        }
+        if (length == sizeof(buffer)) {
+            return false;
+        }
+        buffer[length++] = c;
+    }
+    if (length < 19) {
+        return false;
+    }
+
+    auto number = [&](size_t pos, size_t digits, unsigned& value) {
+        value = 0;
+        for (size_t i = pos; i < pos + digits; ++i) {
+            if (buffer[i] < '0' || buffer[i] > '9') {
+                return false;
+            }
+            value = value * 10 + static_cast<unsigned>(buffer[i] - '0');
+        }
+        return true;
+    };
+
+    unsigned year, month, day, hour, minute, second;
+    if (!number(0, 4, year) || buffer[4] != '-' || !number(5, 2, month) || buffer[7] != '-' || !number(8, 2, day)
+        || buffer[10] != 'T' || !number(11, 2, hour) || buffer[13] != ':' || !number(14, 2, minute)
+        || buffer[16] != ':' || !number(17, 2, second)) {
+        return false;
+    }
+
+    unsigned millis = 0;
+    if (length > 19) {
+        size_t fraction = length - 20;
+        if (buffer[19] != '.' || fraction == 0 || fraction > 9 || !number(20, fraction, millis)) {
+            return false;
+        }
+        for (; fraction < 3; ++fraction) {
+            millis *= 10;
+        }
+        for (; fraction > 3; --fraction) {
+            millis /= 10;
+        }
+    }
+
+    static const unsigned daysInMonth[] = { 31, 29, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31 };
+    bool leap = year % 4 == 0 && (year % 100 != 0 || year % 400 == 0);
+    if (month < 1 || month > 12 || day < 1 || day > daysInMonth[month - 1] || (month == 2 && day == 29 && !leap)
+        || hour > 23 || minute > 59 || second > 59) {
+        return false;
+    }
+
+    result = ((daysFromCivil(year, month, day) * 24 + hour) * 60 + minute) * 60000 + second * 1000 + millis;
+    return true;
+}
+
+// Appends YYYY-MM-DDTHH:MM:SS.mmm; years outside 0..9999 go through snprintf
+void appendTimestamp(std::string& out, int64_t timestamp) {
+    int64_t days = (timestamp >= 0 ? timestamp : timestamp - 86399999) / 86400000;
+    unsigned millis = static_cast<unsigned>(timestamp - days * 86400000);
+    int64_t year;
+    unsigned month, day;
+    civilFromDays(days, year, month, day);
+
+    if (year < 0 || year > 9999) {
+        char buffer[48];
+        snprintf(buffer, sizeof(buffer), "%04lld-%02u-%02uT%02u:%02u:%02u.%03u", static_cast<long long>(year), month, day,
+            millis / 3600000 % 24, millis / 60000 % 60, millis / 1000 % 60, millis % 1000);
+        out += buffer;
+        return;
+    }
+    char buffer[] = "0000-00-00T00:00:00.000";
+    auto digits = [&buffer](size_t at, size_t width, unsigned value) {
+        for (size_t i = width; i-- > 0; value /= 10) {
+            buffer[at + i] = static_cast<char>('0' + value % 10);
+        }
+    };
+    digits(0, 4, static_cast<unsigned>(year));
+    digits(5, 2, month);
+    digits(8, 2, day);
+    digits(11, 2, millis / 3600000 % 24);
+    digits(14, 2, millis / 60000 % 60);
+    digits(17, 2, millis / 1000 % 60);
+    digits(20, 3, millis % 1000);
+    out.append(buffer, sizeof(buffer) - 1);
+}
+
+std::string formatTimestamp(int64_t timestamp) {
     std::string text;
+    appendTimestamp(text, timestamp);
+    return text;
+}
+
+class MappedFile {
+public:
+    explicit MappedFile(const std::string& filename) {
+#ifdef _WIN32
+        file = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_DELETE, nullptr,
+            OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+        if (file == INVALID_HANDLE_VALUE) {
+            throw std::runtime_error("Error opening file: " + filename);
+        }
+        LARGE_INTEGER size;
+        if (!GetFileSizeEx(file, &size)) {
+            release();
+            throw std::runtime_error("Error reading size of file: " + filename);
+        }
+        length = static_cast<size_t>(size.QuadPart);
+        if (length == 0) {
+            return;
+        }
+        mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        if (mapping != nullptr) {
+            data = static_cast<const char*>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+        }
+        if (data == nullptr) {
+            release();
+            throw std::runtime_error("Error mapping file: " + filename);
+        }
+#else
+        int descriptor = open(filename.c_str(), O_RDONLY);
+        if (descriptor < 0) {
+            throw std::runtime_error("Error opening file: " + filename);
+        }
+        struct stat info;
+        if (fstat(descriptor, &info) != 0) {
+            close(descriptor);
+            throw std::runtime_error("Error reading size of file: " + filename);
+        }
+        length = static_cast<size_t>(info.st_size);
+        if (length > 0) {
+            void* mapped = mmap(nullptr, length, PROT_READ, MAP_PRIVATE, descriptor, 0);
+            if (mapped == MAP_FAILED) {
+                close(descriptor);
+                length = 0;
+                throw std::runtime_error("Error mapping file: " + filename);
+            }
+            madvise(mapped, length, MADV_SEQUENTIAL);
+            data = static_cast<const char*>(mapped);
+        }
+        close(descriptor);
+#endif
+    }
+
+    ~MappedFile() {
+        release();
+    }
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    std::string_view view() const {
+        return std::string_view(data, length);
+    }
+
+private:
+    const char* data = nullptr;
+    size_t length = 0;
+#ifdef _WIN32
+    HANDLE file = INVALID_HANDLE_VALUE;
+    HANDLE mapping = nullptr;
+#endif
+
+    void release() {
+#ifdef _WIN32
+        if (data != nullptr) {
+            UnmapViewOfFile(data);
+        }
+        if (mapping != nullptr) {
+            CloseHandle(mapping);
+        }
+        if (file != INVALID_HANDLE_VALUE) {
+            CloseHandle(file);
+        }
+        mapping = nullptr;
+        file = INVALID_HANDLE_VALUE;
+#else
+        if (data != nullptr) {
+            munmap(const_cast<char*>(data), length);
+        }
+#endif
+        data = nullptr;
+        length = 0;
+    }
+};
+
+// A message as seen by queries: views into the memory rows or into a mapped segment
+struct MessageRef {
+    int64_t time;
+    std::string_view user;
+    std::string_view text;
+};
+
+// Calls visit(token) for every word of the text: runs of ASCII letters and digits, lowered,
+// or of non-ASCII bytes (so UTF-8 words stay whole)
+template <typename Visitor>
+void forEachToken(std::string_view text, Visitor visit) {
+    std::string token;
+    for (size_t i = 0; i <= text.size(); ++i) {
+        unsigned char c = i < text.size() ? static_cast<unsigned char>(text[i]) : ' ';
+        if (c >= 0x80 || std::isalnum(c)) {
+            token += static_cast<char>(c < 0x80 ? std::tolower(c) : c);
+        }
+        else if (!token.empty()) {
+            visit(std::string_view(token));
+            token.clear();
+        }
+    }
+}
+
+// Inverted index over message text: token -> rows containing it, in increasing row order.
+// Rows are delta- and varint-encoded in blocks of BLOCK_SIZE; each block header keeps its
+// first/last row and time bounds, so intersections and time filters skip whole blocks.
+// Segments store the same blocks in their files and search them through PostingView.
+class TextIndex {
+public:
+    static constexpr uint32_t BLOCK_SIZE = 128;
+
+    struct Block {
+        uint32_t firstRow;
+        uint32_t lastRow;
+        int64_t minTime;
+        int64_t maxTime;
+        uint64_t offset;
+        uint32_t count;
+        uint32_t unused = 0;
+
+        bool overlaps(int64_t start, int64_t end) const {
+            return minTime <= end && maxTime >= start;
+        }
+    };
+
+    // The posting list of one token, in the heap or in a mapped segment; offsets of the blocks
+    // are relative to bytes. An unknown token has no blocks.
+    struct PostingView {
+        const Block* blocks = nullptr;
+        size_t blockCount = 0;
+        const uint8_t* bytes = nullptr;
+        size_t byteCount = 0;
+        size_t count = 0;
+
+        void decode(size_t index, std::vector<uint32_t>& rows) const {
+            const Block& block = blocks[index];
+            const uint8_t* in = bytes + block.offset;
+            uint32_t row = block.firstRow;
+            rows.push_back(row);
+            for (uint32_t i = 1; i < block.count; ++i) {
+                uint32_t delta = 0;
+                for (int shift = 0; ; shift += 7) {
+                    uint8_t byte = *in++;
+                    delta |= static_cast<uint32_t>(byte & 0x7F) << shift;
+                    if (byte < 0x80) {
+                        break;
+                    }
+                }
+                row += delta;
+                rows.push_back(row);
+            }
+        }
+    };
+
+    void add(uint32_t row, int64_t time, std::string_view text) {
+        forEachToken(text, [&](std::string_view token) {
+            auto it = postings.find(token);
+            if (it == postings.end()) {
+                tokens.emplace_back(token);
+                it = postings.emplace(tokens.back(), PostingList()).first;
+            }
+            it->second.append(row, time);
+            });
+    }
+
+    // Rows that contain all (matchAll) or any of the query words and whose block may fall
+    // into [start, end]; the caller still checks the time of each row
+    std::vector<uint32_t> search(std::string_view query, bool matchAll, int64_t start, int64_t end) const {
+        return search(query, matchAll, start, end, [this](std::string_view token) {
+            auto it = postings.find(token);
+            return it == postings.end() ? PostingView() : it->second.view();
+            });
+    }
+
+    // The same search over posting lists found by lookup(token)
+    template <typename Lookup>
+    static std::vector<uint32_t> search(std::string_view query, bool matchAll, int64_t start, int64_t end, Lookup lookup) {
+        std::vector<PostingView> lists;
+        bool missing = false;
+        forEachToken(query, [&](std::string_view token) {
+            PostingView list = lookup(token);
+            if (list.blockCount == 0) {
+                missing = true;
+            }
+            else if (std::find_if(lists.begin(), lists.end(), [&](const PostingView& other) { return other.blocks == list.blocks; }) == lists.end()) {
+                lists.push_back(list);
+            }
+            });
+
+        std::vector<uint32_t> rows;
+        if (lists.empty() || (matchAll && missing)) {
+            return rows;
+        }
+
+        if (!matchAll) {
+            for (const PostingView& list : lists) {
+                for (size_t block = 0; block < list.blockCount; ++block) {
+                    if (list.blocks[block].overlaps(start, end)) {
+                        list.decode(block, rows);
+                    }
+                }
+            }
+            std::sort(rows.begin(), rows.end());
+            rows.erase(std::unique(rows.begin(), rows.end()), rows.end());
+            return rows;
+        }
+
+        std::sort(lists.begin(), lists.end(), [](const PostingView& a, const PostingView& b) { return a.count < b.count; });
+        std::vector<Cursor> cursors;
+        for (size_t i = 1; i < lists.size(); ++i) {
+            cursors.emplace_back(lists[i]);
+        }
+        std::vector<uint32_t> candidates;
+        const PostingView& smallest = lists.front();
+        for (size_t block = 0; block < smallest.blockCount; ++block) {
+            if (!smallest.blocks[block].overlaps(start, end)) {
+                continue;
+            }
+            candidates.clear();
+            smallest.decode(block, candidates);
+            for (uint32_t row : candidates) {
+                bool everywhere = true;
+                for (auto& cursor : cursors) {
+                    uint32_t found;
+                    if (!cursor.seek(row, found)) {
+                        return rows;
+                    }
+                    if (found != row) {
+                        everywhere = false;
+                        break;
+                    }
+                }
+                if (everywhere) {
+                    rows.push_back(row);
+                }
+            }
+        }
+        return rows;
+    }
+
+    // Calls visit(token, list) for every token in increasing byte order
+    template <typename Visitor>
+    void forEachList(Visitor visit) const {
+        std::vector<std::string_view> sorted(tokens.begin(), tokens.end());
+        std::sort(sorted.begin(), sorted.end());
+        for (auto token : sorted) {
+            visit(token, postings.find(token)->second.view());
+        }
+    }
+
+    // Approximate heap bytes of the tokens, the hash table and the posting lists
+    size_t memoryUsage() const {
+        size_t bytes = postings.bucket_count() * sizeof(void*);
+        for (const auto& token : tokens) {
+            bytes += sizeof(std::string) + (token.capacity() > 15 ? token.capacity() + 1 : 0);
+        }
+        for (const auto& entry : postings) {
+            bytes += sizeof(entry) + 2 * sizeof(void*) + entry.second.blocks.capacity() * sizeof(Block) + entry.second.bytes.capacity();
+        }
+        return bytes;
+    }
+
+private:
+    struct PostingList {
+        std::vector<Block> blocks;
+        std::vector<uint8_t> bytes;
+        size_t count = 0;
+
+        void append(uint32_t row, int64_t time) {
+            if (!blocks.empty() && blocks.back().lastRow == row) {
+                return;
+            }
+            ++count;
+            if (blocks.empty() || blocks.back().count == BLOCK_SIZE) {
+                blocks.push_back(Block{ row, row, time, time, bytes.size(), 1 });
+                return;
+            }
+            Block& block = blocks.back();
+            for (uint32_t delta = row - block.lastRow; ; delta >>= 7) {
+                if (delta < 0x80) {
+                    bytes.push_back(static_cast<uint8_t>(delta));
+                    break;
+                }
+                bytes.push_back(static_cast<uint8_t>(delta | 0x80));
+            }
+            block.lastRow = row;
+            block.minTime = std::min(block.minTime, time);
+            block.maxTime = std::max(block.maxTime, time);
+            ++block.count;
+        }
+
+        PostingView view() const {
+            return PostingView{ blocks.data(), blocks.size(), bytes.data(), bytes.size(), count };
+        }
+    };
+
+    // Walks a posting list forward, decoding only the blocks it lands in
+    class Cursor {
+    public:
+        explicit Cursor(const PostingView& postingList) : list(postingList) {}
+
+        // Finds the smallest row >= target; false when the list is exhausted
+        bool seek(uint32_t target, uint32_t& found) {
+            if (block == NONE || list.blocks[block].lastRow < target) {
+                size_t from = block == NONE ? 0 : block + 1;
+                const Block* it = std::lower_bound(list.blocks + from, list.blocks + list.blockCount, target,
+                    [](const Block& b, uint32_t value) { return b.lastRow < value; });
+                if (it == list.blocks + list.blockCount) {
+                    return false;
+                }
+                block = static_cast<size_t>(it - list.blocks);
+                decoded.clear();
+                list.decode(block, decoded);
+                position = 0;
+            }
+            position = static_cast<size_t>(std::lower_bound(decoded.begin() + static_cast<std::ptrdiff_t>(position), decoded.end(), target) - decoded.begin());
+            found = decoded[position];
+            return true;
+        }
+
+    private:
+        static constexpr size_t NONE = static_cast<size_t>(-1);
+
+        PostingView list;
+        size_t block = NONE;
+        size_t position = 0;
+        std::vector<uint32_t> decoded;
+    };
+
+    std::deque<std::string> tokens;
+    std::unordered_map<std::string_view, PostingList> postings;
+};
+
+// Immutable file with the messages of one day, sorted by (time, user). After the header come
+// the user bloom filter, the time and text-end columns, the user table (name ends and posting
+// ends), the user-id column, the per-user postings, the user names and the texts, followed by
+// the text index: the token table (name ends, block ends, byte ends and posting counts, tokens
+// in byte order), the posting blocks, their varint bytes and the token names. Sections are
+// 8-byte aligned and written in the machine's byte order. MessageStore keeps its memory runs
+// in the same layout in a heap buffer.
+class Segment {
+public:
+    explicit Segment(const std::string& filename) : file(std::make_unique<MappedFile>(filename)) {
+        parse(file->view(), filename);
+    }
+
+    // Builds the segment in a heap buffer from messages sorted by (time, user) with unique keys.
+    // The buffer is longer than any short string, so it comes from the allocator and is aligned.
+    explicit Segment(const std::vector<MessageRef>& messages) : owned(encode(messages)) {
+        parse(owned, "memory run");
+    }
+
+    // Writes messages sorted by (time, user) with unique keys
+    static void write(const std::string& filename, const std::vector<MessageRef>& messages) {
+        std::string bytes = encode(messages);
+        std::ofstream out(filename, std::ios::binary);
+        if (!out) {
+            throw std::runtime_error("Error creating file: " + filename);
+        }
+        out.write(bytes.data(), static_cast<std::streamsize>(bytes.size()));
+        out.close();
+        if (!out) {
+            throw std::runtime_error("Error writing file: " + filename);
+        }
+    }
+
+    // The file image of messages sorted by (time, user) with unique keys
+    static std::string encode(const std::vector<MessageRef>& messages) {
+        std::vector<std::string_view> userTable;
+        for (const auto& msg : messages) {
+            userTable.push_back(msg.user);
+        }
+        std::sort(userTable.begin(), userTable.end());
+        userTable.erase(std::unique(userTable.begin(), userTable.end()), userTable.end());
+
+        Header head;
+        std::memcpy(head.magic, MAGIC, sizeof(head.magic));
+        head.count = messages.size();
+        head.userCount = userTable.size();
+        head.minTime = messages.empty() ? 0 : messages.front().time;
+        head.maxTime = messages.empty() ? 0 : messages.back().time;
+        head.bloomWords = std::max<uint64_t>(1, (userTable.size() * 10 + 63) / 64);
+        head.nameBytes = 0;
+        head.textBytes = 0;
+
+        std::vector<uint64_t> bloomBits(head.bloomWords, 0);
+        std::vector<uint64_t> nameEndColumn;
+        for (auto name : userTable) {
+            head.nameBytes += name.size();
+            nameEndColumn.push_back(head.nameBytes);
+            forEachBloomBit(name, head.bloomWords, [&](uint64_t bit) { bloomBits[bit / 64] |= uint64_t(1) << (bit % 64); });
+        }
+
+        std::vector<int64_t> timeColumn;
+        std::vector<uint64_t> textEndColumn;
+        std::vector<uint32_t> userIdColumn;
+        std::vector<uint64_t> postingEndColumn(userTable.size(), 0);
+        TextIndex index;
+        for (const auto& msg : messages) {
+            uint32_t userId = static_cast<uint32_t>(std::lower_bound(userTable.begin(), userTable.end(), msg.user) - userTable.begin());
+            index.add(static_cast<uint32_t>(timeColumn.size()), msg.time, msg.text);
+            timeColumn.push_back(msg.time);
+            head.textBytes += msg.text.size();
+            textEndColumn.push_back(head.textBytes);
+            userIdColumn.push_back(userId);
+            ++postingEndColumn[userId];
+        }
+        for (size_t i = 1; i < postingEndColumn.size(); ++i) {
+            postingEndColumn[i] += postingEndColumn[i - 1];
+        }
+        std::vector<uint32_t> postingColumn(messages.size());
+        std::vector<uint64_t> fill(userTable.size(), 0);
+        for (size_t i = 0; i < messages.size(); ++i) {
+            uint32_t userId = userIdColumn[i];
+            uint64_t begin = userId == 0 ? 0 : postingEndColumn[userId - 1];
+            postingColumn[begin + fill[userId]++] = static_cast<uint32_t>(i);
+        }
+
+        std::vector<uint64_t> tokenEndColumn;
+        std::vector<uint64_t> blockEndColumn;
+        std::vector<uint64_t> byteEndColumn;
+        std::vector<uint64_t> postingCountColumn;
+        std::vector<TextIndex::Block> blockColumn;
+        std::vector<uint8_t> postingByteColumn;
+        std::string tokenNameColumn;
+        index.forEachList([&](std::string_view token, const TextIndex::PostingView& list) {
+            tokenNameColumn.append(token.data(), token.size());
+            tokenEndColumn.push_back(tokenNameColumn.size());
+            blockColumn.insert(blockColumn.end(), list.blocks, list.blocks + list.blockCount);
+            blockEndColumn.push_back(blockColumn.size());
+            postingByteColumn.insert(postingByteColumn.end(), list.bytes, list.bytes + list.byteCount);
+            byteEndColumn.push_back(postingByteColumn.size());
+            postingCountColumn.push_back(list.count);
+            });
+        head.tokenCount = tokenEndColumn.size();
+        head.blockCount = blockColumn.size();
+        head.postingBytes = postingByteColumn.size();
+        head.tokenBytes = tokenNameColumn.size();
+
+        auto padded = [](uint64_t size) { return static_cast<size_t>((size + 7) / 8 * 8); };
+        std::string out;
+        out.reserve(sizeof(head) + padded(head.bloomWords * 8) + 2 * padded(head.count * 8) + 2 * padded(head.userCount * 8)
+            + 2 * padded(head.count * 4) + padded(head.nameBytes) + padded(head.textBytes) + 4 * padded(head.tokenCount * 8)
+            + padded(head.blockCount * sizeof(TextIndex::Block)) + padded(head.postingBytes) + padded(head.tokenBytes));
+        auto pad = [&](uint64_t size) {
+            out.append(static_cast<size_t>((8 - size % 8) % 8), '\0');
+        };
+        auto writeSection = [&](const void* data, uint64_t size) {
+            out.append(static_cast<const char*>(data), static_cast<size_t>(size));
+            pad(size);
+        };
+        out.append(reinterpret_cast<const char*>(&head), sizeof(head));
+        writeSection(bloomBits.data(), bloomBits.size() * 8);
+        writeSection(timeColumn.data(), timeColumn.size() * 8);
+        writeSection(textEndColumn.data(), textEndColumn.size() * 8);
+        writeSection(nameEndColumn.data(), nameEndColumn.size() * 8);
+        writeSection(postingEndColumn.data(), postingEndColumn.size() * 8);
+        writeSection(userIdColumn.data(), userIdColumn.size() * 4);
+        writeSection(postingColumn.data(), postingColumn.size() * 4);
+        for (auto name : userTable) {
+            out.append(name.data(), name.size());
+        }
+        pad(head.nameBytes);
+        for (const auto& msg : messages) {
+            out.append(msg.text.data(), msg.text.size());
+        }
+        pad(head.textBytes);
+        writeSection(tokenEndColumn.data(), tokenEndColumn.size() * 8);
+        writeSection(blockEndColumn.data(), blockEndColumn.size() * 8);
+        writeSection(byteEndColumn.data(), byteEndColumn.size() * 8);
+        writeSection(postingCountColumn.data(), postingCountColumn.size() * 8);
+        writeSection(blockColumn.data(), blockColumn.size() * sizeof(TextIndex::Block));
+        writeSection(postingByteColumn.data(), postingByteColumn.size());
+        writeSection(tokenNameColumn.data(), tokenNameColumn.size());
+        return out;
+    }
+
+    size_t size() const {
+        return header->count;
+    }
+
+    int64_t minTime() const {
+        return header->minTime;
+    }
+
+    int64_t maxTime() const {
+        return header->maxTime;
+    }
+
+    int64_t time(size_t entry) const {
+        return times[entry];
+    }
+
+    std::string_view user(size_t entry) const {
+        return userName(users[entry]);
+    }
+
+    std::string_view text(size_t entry) const {
+        uint64_t begin = entry == 0 ? 0 : textEnds[entry - 1];
+        return std::string_view(texts + begin, textEnds[entry] - begin);
+    }
+
+    MessageRef message(size_t entry) const {
+        return MessageRef{ time(entry), user(entry), text(entry) };
+    }
+
+    bool mayContainUser(std::string_view name) const {
+        bool all = true;
+        forEachBloomBit(name, header->bloomWords, [&](uint64_t bit) { all = all && (bloom[bit / 64] >> (bit % 64) & 1); });
+        return all;
+    }
+
+    // The user's entries in time order; empty when the user has no messages here
+    std::pair<const uint32_t*, const uint32_t*> userEntries(std::string_view name) const {
+        if (!mayContainUser(name)) {
+            return { postings, postings };
+        }
+        size_t low = 0;
+        size_t high = header->userCount;
+        while (low < high) {
+            size_t middle = (low + high) / 2;
+            if (userName(static_cast<uint32_t>(middle)) < name) {
+                low = middle + 1;
+            }
+            else {
+                high = middle;
+            }
+        }
+        if (low == header->userCount || userName(static_cast<uint32_t>(low)) != name) {
+            return { postings, postings };
+        }
+        uint64_t begin = low == 0 ? 0 : postingEnds[low - 1];
+        return { postings + begin, postings + postingEnds[low] };
+    }
+
+    size_t lowerBound(int64_t value) const {
+        return static_cast<size_t>(std::lower_bound(times, times + header->count, value) - times);
+    }
+
+    size_t upperBound(int64_t value) const {
+        return static_cast<size_t>(std::upper_bound(times, times + header->count, value) - times);
+    }
+
+    // Entries that contain all (matchAll) or any of the query words, as in TextIndex::search;
+    // the posting lists are read from the mapped file
+    std::vector<uint32_t> search(std::string_view query, bool matchAll, int64_t start, int64_t end) const {
+        return TextIndex::search(query, matchAll, start, end, [this](std::string_view token) { return postingList(token); });
+    }
+
+    // Heap bytes besides the mapping: the buffer of a memory run
+    size_t memoryUsage() const {
+        return owned.capacity();
+    }
+
+private:
+    static constexpr char MAGIC[9] = "MSGSEG02";
+
+    struct Header {
+        char magic[8];
+        uint64_t count;
+        uint64_t userCount;
+        int64_t minTime;
+        int64_t maxTime;
+        uint64_t bloomWords;
+        uint64_t nameBytes;
+        uint64_t textBytes;
+        uint64_t tokenCount;
+        uint64_t blockCount;
+        uint64_t postingBytes;
+        uint64_t tokenBytes;
+    };
+    static_assert(sizeof(TextIndex::Block) % 8 == 0, "posting blocks are stored as an 8-byte aligned array");
+
+    std::unique_ptr<MappedFile> file;
+    std::string owned;
+    const Header* header = nullptr;
+    const uint64_t* bloom = nullptr;
+    const int64_t* times = nullptr;
+    const uint64_t* textEnds = nullptr;
+    const uint64_t* nameEnds = nullptr;
+    const uint64_t* postingEnds = nullptr;
+    const uint32_t* users = nullptr;
+    const uint32_t* postings = nullptr;
+    const char* names = nullptr;
+    const char* texts = nullptr;
+    const uint64_t* tokenEnds = nullptr;
+    const uint64_t* blockEnds = nullptr;
+    const uint64_t* byteEnds = nullptr;
+    const uint64_t* postingCounts = nullptr;
+    const TextIndex::Block* blocks = nullptr;
+    const uint8_t* postingBytes = nullptr;
+    const char* tokenNames = nullptr;
+
+    // Points the sections into bytes; name identifies the segment in errors
+    void parse(std::string_view bytes, const std::string& name) {
+        if (bytes.size() < sizeof(Header) || std::memcmp(bytes.data(), MAGIC, sizeof(header->magic)) != 0) {
+            throw std::runtime_error("Not a message segment: " + name);
+        }
+        header = reinterpret_cast<const Header*>(bytes.data());
+        const char* cursor = bytes.data() + sizeof(Header);
+        auto section = [&](uint64_t size) {
+            const char* start = cursor;
+            cursor += (size + 7) / 8 * 8;
+            return start;
+        };
+        bloom = reinterpret_cast<const uint64_t*>(section(header->bloomWords * 8));
+        times = reinterpret_cast<const int64_t*>(section(header->count * 8));
+        textEnds = reinterpret_cast<const uint64_t*>(section(header->count * 8));
+        nameEnds = reinterpret_cast<const uint64_t*>(section(header->userCount * 8));
+        postingEnds = reinterpret_cast<const uint64_t*>(section(header->userCount * 8));
+        users = reinterpret_cast<const uint32_t*>(section(header->count * 4));
+        postings = reinterpret_cast<const uint32_t*>(section(header->count * 4));
+        names = section(header->nameBytes);
+        texts = section(header->textBytes);
+        tokenEnds = reinterpret_cast<const uint64_t*>(section(header->tokenCount * 8));
+        blockEnds = reinterpret_cast<const uint64_t*>(section(header->tokenCount * 8));
+        byteEnds = reinterpret_cast<const uint64_t*>(section(header->tokenCount * 8));
+        postingCounts = reinterpret_cast<const uint64_t*>(section(header->tokenCount * 8));
+        blocks = reinterpret_cast<const TextIndex::Block*>(section(header->blockCount * sizeof(TextIndex::Block)));
+        postingBytes = reinterpret_cast<const uint8_t*>(section(header->postingBytes));
+        tokenNames = section(header->tokenBytes);
+        if (cursor > bytes.data() + bytes.size()) {
+            throw std::runtime_error("Truncated message segment: " + name);
+        }
+    }
+
+    std::string_view userName(uint32_t userId) const {
+        uint64_t begin = userId == 0 ? 0 : nameEnds[userId - 1];
+        return std::string_view(names + begin, nameEnds[userId] - begin);
+    }
+
+    std::string_view tokenName(size_t tokenId) const {
+        uint64_t begin = tokenId == 0 ? 0 : tokenEnds[tokenId - 1];
+        return std::string_view(tokenNames + begin, tokenEnds[tokenId] - begin);
+    }
+
+    // The posting list of the token, found by binary search in the token table
+    TextIndex::PostingView postingList(std::string_view token) const {
+        size_t low = 0;
+        size_t high = header->tokenCount;
+        while (low < high) {
+            size_t middle = (low + high) / 2;
+            if (tokenName(middle) < token) {
+                low = middle + 1;
+            }
+            else {
+                high = middle;
+            }
+        }
+        if (low == header->tokenCount || tokenName(low) != token) {
+            return TextIndex::PostingView();
+        }
+        uint64_t firstBlock = low == 0 ? 0 : blockEnds[low - 1];
+        uint64_t firstByte = low == 0 ? 0 : byteEnds[low - 1];
+        return TextIndex::PostingView{ blocks + firstBlock, blockEnds[low] - firstBlock, postingBytes + firstByte,
+            byteEnds[low] - firstByte, postingCounts[low] };
+    }
+
+    template <typename Visitor>
+    static void forEachBloomBit(std::string_view name, uint64_t words, Visitor visit) {
+        uint64_t hash = 14695981039346656037ull;
+        for (char c : name) {
+            hash = (hash ^ static_cast<unsigned char>(c)) * 1099511628211ull;
+        }
+        uint64_t step = (hash >> 32) | 1;
+        for (int i = 0; i < 4; ++i) {
+            visit((hash + i * step) % (words * 64));
+        }
+    }
+};
+
+// Gathers output in a block and hands it to the stream in large writes, so records are never
+// flushed one by one. The rest of the block is written on flush() and on destruction.
+class OutputSink {
+public:
+    explicit OutputSink(std::ostream& stream, size_t capacity = 1 << 16) : stream(stream), capacity(capacity) {
+        buffer.reserve(capacity);
+    }
+
+    OutputSink(const OutputSink&) = delete;
+    OutputSink& operator=(const OutputSink&) = delete;
+
+    ~OutputSink() {
+        flush();
+    }
+
+    // The caller appends one record to text() and then calls commit()
+    std::string& text() {
+        return buffer;
+    }
+
+    void commit() {
+        if (buffer.size() >= capacity) {
+            drain();
+        }
+    }
+
+    void flush() {
+        drain();
+        stream.flush();
+    }
+
+private:
+    void drain() {
+        if (!buffer.empty()) {
+            stream.write(buffer.data(), static_cast<std::streamsize>(buffer.size()));
+            buffer.clear();
+        }
+    }
+
+    std::ostream& stream;
+    size_t capacity;
+    std::string buffer;
+};
+
+// Text is the "user time: text" form of the print functions
+enum class OutputFormat { Text, JsonLines, Csv };
+
+bool parseOutputFormat(std::string_view name, OutputFormat& format) {
+    if (name == "text") {
+        format = OutputFormat::Text;
+    }
+    else if (name == "jsonl") {
+        format = OutputFormat::JsonLines;
+    }
+    else if (name == "csv") {
+        format = OutputFormat::Csv;
+    }
+    else {
+        return false;
+    }
+    return true;
+}
+
+// Writes messages to a stream in one of the output formats. JSON strings escape quotes,
+// backslashes and control characters; CSV fields are quoted when they hold a comma, a quote or a
+// line break, and the CSV output starts with a "user,time,text" header.
+class MessageWriter {
+public:
+    MessageWriter(std::ostream& stream, OutputFormat format) : sink(stream), format(format) {
+        if (format == OutputFormat::Csv) {
+            sink.text() += "user,time,text\n";
+        }
+    }
+
+    void write(const MessageRef& msg) {
+        std::string& out = sink.text();
+        switch (format) {
+        case OutputFormat::Text:
+            out.append(msg.user.data(), msg.user.size());
+            out += ' ';
+            appendTimestamp(out, msg.time);
+            out += ": ";
+            out.append(msg.text.data(), msg.text.size());
+            break;
+        case OutputFormat::JsonLines:
+            out += "{\"user\":";
+            appendJson(out, msg.user);
+            out += ",\"time\":\"";
+            appendTimestamp(out, msg.time);
+            out += "\",\"text\":";
+            appendJson(out, msg.text);
+            out += '}';
+            break;
+        case OutputFormat::Csv:
+            appendCsv(out, msg.user);
+            out += ',';
+            appendTimestamp(out, msg.time);
+            out += ',';
+            appendCsv(out, msg.text);
+            break;
+        }
+        out += '\n';
+        sink.commit();
+        ++count;
+    }
+
+    // Writes every message of a range (or any container of MessageRef); returns how many
+    template <typename Messages>
+    size_t writeAll(Messages&& messages) {
+        size_t before = count;
+        for (const MessageRef& msg : messages) {
+            write(msg);
+        }
+        return count - before;
+    }
+
+    void flush() {
+        sink.flush();
+    }
+
+    size_t written() const {
+        return count;
+    }
+
+private:
+    static void appendJson(std::string& out, std::string_view value) {
+        static const char hex[] = "0123456789abcdef";
+        out += '"';
+        for (char c : value) {
+            unsigned char byte = static_cast<unsigned char>(c);
+            if (c == '"' || c == '\\') {
+                out += '\\';
+                out += c;
+            }
+            else if (c == '\n') {
+                out += "\\n";
+            }
+            else if (c == '\t') {
+                out += "\\t";
+            }
+            else if (byte < 0x20) {
+                out += "\\u00";
+                out += hex[byte >> 4];
+                out += hex[byte & 15];
+            }
+            else {
+                out += c;
+            }
+        }
+        out += '"';
+    }
+
+    static void appendCsv(std::string& out, std::string_view value) {
+        if (value.find_first_of(",\"\r\n") == std::string_view::npos) {
+            out.append(value.data(), value.size());
+            return;
+        }
+        out += '"';
+        for (char c : value) {
+            if (c == '"') {
+                out += '"';
+            }
+            out += c;
+        }
+        out += '"';
+    }
+
+    OutputSink sink;
+    OutputFormat format;
+    size_t count = 0;
+};
+
+// Append-only buffer for messages arriving from many threads. A producer claims a slot with one
+// fetch_add and publishes it with a release store, so producers never wait for each other or for
+// readers; readers see every published slot.
+class IngestBuffer {
+public:
+    static constexpr size_t CAPACITY = 4096;
+
+    IngestBuffer() : slots(new Slot[CAPACITY]) {}
+
+    // False when the buffer is full or sealed
+    bool append(std::string_view user, int64_t time, std::string_view text) {
+        size_t index = claimed.fetch_add(1, std::memory_order_relaxed);
+        if (index >= CAPACITY) {
+            return false;
+        }
+        Slot& slot = slots[index];
+        slot.user.assign(user.data(), user.size());
+        slot.time = time;
+        slot.text.assign(text.data(), text.size());
+        slot.ready.store(true, std::memory_order_release);
+        published.fetch_add(1, std::memory_order_release);
+        return true;
+    }
+
+    bool empty() const {
+        return claimed.load(std::memory_order_acquire) == 0;
+    }
+
+    // Stops further appends and waits until every slot claimed before is published
+    void seal() {
+        size_t count = std::min(claimed.fetch_add(CAPACITY, std::memory_order_acq_rel), CAPACITY);
+        while (published.load(std::memory_order_acquire) < count) {
+            std::this_thread::yield();
+        }
+    }
+
+    template <typename Visitor>
+    void forEachReady(Visitor visit) const {
+        size_t count = std::min(claimed.load(std::memory_order_acquire), CAPACITY);
+        for (size_t i = 0; i < count; ++i) {
+            const Slot& slot = slots[i];
+            if (slot.ready.load(std::memory_order_acquire)) {
+                visit(MessageRef{ slot.time, slot.user, slot.text });
+            }
+        }
+    }
+
+private:
+    struct Slot {
+        std::string user;
+        int64_t time = 0;
+        std::string text;
+        std::atomic<bool> ready{ false };
+    };
+
+    std::unique_ptr<Slot[]> slots;
+    std::atomic<size_t> claimed{ 0 };
+    std::atomic<size_t> published{ 0 };
+};
+
+// Deletion marks of the entries of one segment, in chunks of CHUNK_BITS bits. A chunk without
+// marks is not allocated. Copies share their chunks; set() copies a chunk that is still shared
+// before marking it, so a copy can be changed while readers keep using the original.
+class Tombstones {
+public:
+    explicit Tombstones(size_t entries) : chunks((entries + CHUNK_BITS - 1) / CHUNK_BITS) {}
+
+    bool test(size_t entry) const {
+        const std::shared_ptr<Chunk>& chunk = chunks[entry / CHUNK_BITS];
+        size_t bit = entry % CHUNK_BITS;
+        return chunk != nullptr && ((*chunk)[bit / 64] >> (bit % 64) & 1);
+    }
+
+    void set(size_t entry) {
+        std::shared_ptr<Chunk>& chunk = chunks[entry / CHUNK_BITS];
+        if (chunk == nullptr) {
+            chunk = std::make_shared<Chunk>();
+        }
+        else if (chunk.use_count() > 1) {
+            chunk = std::make_shared<Chunk>(*chunk);
+        }
+        size_t bit = entry % CHUNK_BITS;
+        (*chunk)[bit / 64] |= uint64_t(1) << (bit % 64);
+    }
+
+    // Heap bytes of the chunk table and the chunks, shared ones included
+    size_t memoryUsage() const {
+        size_t bytes = chunks.capacity() * sizeof(std::shared_ptr<Chunk>);
+        for (const auto& chunk : chunks) {
+            bytes += chunk != nullptr ? sizeof(Chunk) : 0;
+        }
+        return bytes;
+    }
+
+private:
+    static constexpr size_t CHUNK_BITS = 16384;
+    using Chunk = std::array<uint64_t, CHUNK_BITS / 64>;
+
+    std::vector<std::shared_ptr<Chunk>> chunks;
+};
+
+// Messages are kept in three tiers. Just added messages sit in lock-free ingest buffers, which a
+// background thread merges into memory runs: immutable runs in the layout of a segment, merged
+// with each other as they grow so that only a few of them exist. Older messages live in day
+// segments on disk (see Segment), which are mapped at startup and skipped by queries whose time
+// range or user cannot match them. Deletions leave tombstones. The runs and segments with their
+// tombstones form a state that is never changed once published: writers, serialized by
+// writeMutex, build the next state from a copy of the current one and publish it, and a query
+// captures the current state with the buffers not merged into it. Queries therefore never block
+// writers, and producers never wait for a merge.
+class MessageStore {
+    struct StoredSegment;
+    struct State;
+
+    // What a query sees: a published state and the ingest buffers whose messages are not in it
+    struct Snapshot {
+        std::shared_ptr<const State> state;
+        std::vector<std::shared_ptr<IngestBuffer>> buffers;
+    };
+
+public:
+    // Messages of one query in (time, user) order, merged from the segments, the memory runs and
+    // the ingest buffers of a snapshot while the range is iterated; a key present in several
+    // places comes out once. The range keeps its snapshot alive instead of holding a lock, so
+    // writers and producers never wait for it, even on the thread that iterates it.
+    class Range {
+    public:
+        class iterator {
+        public:
+            using iterator_category = std::input_iterator_tag;
+            using value_type = MessageRef;
+            using difference_type = std::ptrdiff_t;
+            using pointer = const MessageRef*;
+            using reference = const MessageRef&;
+
+            iterator() = default;
+
+            reference operator*() const {
+                return current;
+            }
+
+            pointer operator->() const {
+                return &current;
+            }
+
+            iterator& operator++() {
+                if (!range->next(current)) {
+                    range = nullptr;
+                }
+                return *this;
+            }
+
+            bool operator==(const iterator& other) const {
+                return range == other.range;
+            }
+
+            bool operator!=(const iterator& other) const {
+                return range != other.range;
+            }
+
+        private:
+            friend class Range;
+
+            explicit iterator(Range* owner) : range(owner) {
+                ++*this;
+            }
+
+            Range* range = nullptr;
+            MessageRef current{};
+        };
+
+        iterator begin() {
+            return iterator(this);
+        }
+
+        iterator end() {
+            return iterator();
+        }
+
+        // Takes the next message; false once the range is exhausted
+        bool next(MessageRef& msg) {
+            while (!heads.empty()) {
+                std::pop_heap(heads.begin(), heads.end(), after);
+                Head head = heads.back();
+                heads.pop_back();
+                Source& source = sources[head.second];
+                ++source.next;
+                if (settle(source)) {
+                    heads.emplace_back(sourceMessage(source), head.second);
+                    std::push_heap(heads.begin(), heads.end(), after);
+                }
+                if (!emitted || head.first.time != previous.time || head.first.user != previous.user) {
+                    previous = head.first;
+                    emitted = true;
+                    msg = head.first;
+                    return true;
+                }
+            }
+            return false;
+        }
+
+    private:
+        friend class MessageStore;
+
+        // Ingest buffer messages (refs) or entries of a segment or memory run. When indexes is
+        // null the source walks entries next..last directly, otherwise indexes[next..last).
+        struct Source {
+            const Segment* segment;
+            const Tombstones* deleted;
+            const uint32_t* indexes;
+            size_t next;
+            size_t last;
+            const MessageRef* refs;
+        };
+
+        // Heads of the sources; on equal keys the source listed first comes first
+        using Head = std::pair<MessageRef, size_t>;
+
+        static bool after(const Head& a, const Head& b) {
+            if (a.first.time != b.first.time) {
+                return a.first.time > b.first.time;
+            }
+            if (a.first.user != b.first.user) {
+                return a.first.user > b.first.user;
+            }
+            return a.second > b.second;
+        }
+
+        // Segments come first, so they win over a run that repeats one of their keys
+        Range(Snapshot view, int64_t start, int64_t end, const std::string_view* user) : snapshot(std::move(view)) {
+            const State& state = *snapshot.state;
+            auto span = segmentsOverlapping(state.segments, start, end);
+            for (size_t i = span.first; i < span.second; ++i) {
+                addSource(state.segments[i], start, end, user);
+            }
+            for (const auto& run : state.runs) {
+                addSource(run, start, end, user);
+            }
+
+            recent = recentMessages(snapshot.buffers, start, end, user);
+            sources.push_back(Source{ nullptr, nullptr, nullptr, 0, recent.size(), recent.data() });
+
+            for (size_t i = 0; i < sources.size(); ++i) {
+                if (settle(sources[i])) {
+                    heads.emplace_back(sourceMessage(sources[i]), i);
+                }
+            }
+            std::make_heap(heads.begin(), heads.end(), after);
+        }
+
+        void addSource(const StoredSegment& segment, int64_t start, int64_t end, const std::string_view* user) {
+            const Segment& data = segment.data();
+            if (data.maxTime() < start || data.minTime() > end) {
+                return;
+            }
+            if (user == nullptr) {
+                sources.push_back(Source{ &data, segment.deleted.get(), nullptr, data.lowerBound(start), data.upperBound(end), nullptr });
+                return;
+            }
+            auto entries = data.userEntries(*user);
+            auto first = std::lower_bound(entries.first, entries.second, start,
+                [&](uint32_t entry, int64_t value) { return data.time(entry) < value; });
+            auto last = std::upper_bound(first, entries.second, end,
+                [&](int64_t value, uint32_t entry) { return value < data.time(entry); });
+            sources.push_back(Source{ &data, segment.deleted.get(), entries.first, static_cast<size_t>(first - entries.first),
+                static_cast<size_t>(last - entries.first), nullptr });
+        }
+
+        // Moves the source to its next live position; false once it is exhausted
+        static bool settle(Source& source) {
+            if (source.refs == nullptr) {
+                while (source.next < source.last
+                    && source.deleted->test(source.indexes ? source.indexes[source.next] : source.next)) {
+                    ++source.next;
+                }
+            }
+            return source.next < source.last;
+        }
+
+        static MessageRef sourceMessage(const Source& source) {
+            if (source.refs != nullptr) {
+                return source.refs[source.next];
+            }
+            return source.segment->message(source.indexes ? source.indexes[source.next] : source.next);
+        }
+
+        Snapshot snapshot;
+        std::vector<MessageRef> recent;
+        std::vector<Source> sources;
+        std::vector<Head> heads;
+        bool emitted = false;
+        MessageRef previous{};
+    };
+
+    MessageStore() {
+        merger = std::thread([this]() { mergeLoop(); });
+    }
+
+    MessageStore(const MessageStore&) = delete;
+    MessageStore& operator=(const MessageStore&) = delete;
+
+    ~MessageStore() {
+        {
+            std::lock_guard<std::mutex> lock(publishMutex);
+            stopping = true;
+        }
+        mergeNeeded.notify_one();
+        merger.join();
+    }
+
+    Range messages() const {
+        return messagesInRange(std::numeric_limits<int64_t>::min(), std::numeric_limits<int64_t>::max());
+    }
+
+    Range messagesInRange(int64_t start, int64_t end) const {
+        return Range(snapshot(), start, end, nullptr);
+    }
+
+    Range messagesByUser(std::string_view user) const {
+        return messagesByUserInRange(user, std::numeric_limits<int64_t>::min(), std::numeric_limits<int64_t>::max());
+    }
+
+    Range messagesByUserInRange(std::string_view user, int64_t start, int64_t end) const {
+        std::string_view name = trimUser(user);
+        return Range(snapshot(), start, end, &name);
+    }
+
+    struct UserCount {
+        std::string user;
+        size_t count;
+    };
+
+    struct BucketCount {
+        int64_t start;
+        size_t count;
+    };
+
+    struct UserBucketCount {
+        int64_t start;
+        std::string user;
+        size_t count;
+    };
+
+    // Messages per user in [start, end], ordered by user name
+    std::vector<UserCount> countByUser(int64_t start, int64_t end) const {
+        Snapshot view = snapshot();
+        std::vector<UserCount> result;
+        for (const auto& entry : userTotals(view, start, end)) {
+            result.push_back(UserCount{ std::string(entry.first), entry.second });
+        }
+        std::sort(result.begin(), result.end(), [](const UserCount& a, const UserCount& b) { return a.user < b.user; });
+        return result;
+    }
+
+    // The n users with the most messages in [start, end]; equal counts are ordered by user name
+    std::vector<UserCount> topUsers(int64_t start, int64_t end, size_t n) const {
+        Snapshot view = snapshot();
+        std::unordered_map<std::string_view, size_t> totals = userTotals(view, start, end);
+        std::vector<std::pair<std::string_view, size_t>> ranked(totals.begin(), totals.end());
+        auto more = [](const std::pair<std::string_view, size_t>& a, const std::pair<std::string_view, size_t>& b) {
+            return a.second != b.second ? a.second > b.second : a.first < b.first;
+        };
+        n = std::min(n, ranked.size());
+        std::partial_sort(ranked.begin(), ranked.begin() + static_cast<std::ptrdiff_t>(n), ranked.end(), more);
+        std::vector<UserCount> result;
+        for (size_t i = 0; i < n; ++i) {
+            result.push_back(UserCount{ std::string(ranked[i].first), ranked[i].second });
+        }
+        return result;
+    }
+
+    // Messages per time bucket in [start, end]. Buckets are bucketMillis wide and aligned to
+    // multiples of it since the epoch (60000 gives calendar minutes); empty buckets are left out.
+    std::vector<BucketCount> histogram(int64_t start, int64_t end, int64_t bucketMillis) const {
+        std::vector<BucketCount> result;
+        auto fold = [bucketMillis](std::vector<BucketCount>& counts, const MessageRef& msg) {
+            int64_t bucket = bucketStart(msg.time, bucketMillis);
+            if (counts.empty() || counts.back().start != bucket) {
+                counts.push_back(BucketCount{ bucket, 0 });
+            }
+            ++counts.back().count;
+        };
+        for (auto& partial : aggregateSlices<std::vector<BucketCount>>(snapshot(), start, end, bucketMillis, fold)) {
+            result.insert(result.end(), partial.begin(), partial.end());
+        }
+        return result;
+    }
+
+    // Messages per user per time bucket in [start, end], ordered by bucket and then user; the
+    // buckets are as in histogram
+    std::vector<UserBucketCount> histogramByUser(int64_t start, int64_t end, int64_t bucketMillis) const {
+        Snapshot view = snapshot();
+
+        // The users of the bucket being filled are counted in a map and sorted when it closes
+        struct Partial {
+            std::vector<UserBucketCount> counts;
+            int64_t bucket = 0;
+            std::unordered_map<std::string_view, size_t> users;
+
+            void close() {
+                size_t first = counts.size();
+                for (const auto& entry : users) {
+                    counts.push_back(UserBucketCount{ bucket, std::string(entry.first), entry.second });
+                }
+                std::sort(counts.begin() + static_cast<std::ptrdiff_t>(first), counts.end(),
+                    [](const UserBucketCount& a, const UserBucketCount& b) { return a.user < b.user; });
+                users.clear();
+            }
+        };
+        auto fold = [bucketMillis](Partial& partial, const MessageRef& msg) {
+            int64_t bucket = bucketStart(msg.time, bucketMillis);
+            if (bucket != partial.bucket && !partial.users.empty()) {
+                partial.close();
+            }
+            partial.bucket = bucket;
+            ++partial.users[msg.user];
+        };
+        std::vector<UserBucketCount> result;
+        for (auto& partial : aggregateSlices<Partial>(view, start, end, bucketMillis, fold)) {
+            partial.close();
+            std::move(partial.counts.begin(), partial.counts.end(), std::back_inserter(result));
+        }
+        return result;
+    }
+    bool addMessage(const std::string& user, const std::string& time, const std::string& text) {
+        int64_t timestamp;
+        if (!parseTimestamp(time, timestamp)) {
+            return false;
+        }
+        addMessage(trimUser(user), timestamp, text);
+        return true;
+    }
+
+    // Adds a message whose user is already trimmed and whose time is already parsed.
+    // Safe to call from many threads; the producer that fills a buffer queues it for the merger.
+    void addMessage(std::string_view user, int64_t timestamp, std::string_view text) {
+        while (true) {
+            std::shared_ptr<IngestBuffer> buffer = std::atomic_load(&active);
+            if (buffer->append(user, timestamp, text)) {
+                return;
+            }
+            std::lock_guard<std::mutex> lock(publishMutex);
+            if (std::atomic_compare_exchange_strong(&active, &buffer, std::make_shared<IngestBuffer>())) {
+                frozen.push_back(buffer);
+                mergeNeeded.notify_one();
+            }
+        }
+    }
+
+    // Adds many parsed messages as one memory run: feed(add) calls add(user, time, text) for
+    // every message, whose views must stay valid until addBatch returns; count sizes the batch
+    template <typename Feed>
+    void addBatch(size_t count, Feed feed) {
+        std::vector<MessageRef> batch;
+        batch.reserve(count);
+        feed([&batch](std::string_view user, int64_t time, std::string_view text) { batch.push_back(MessageRef{ time, user, text }); });
+        std::lock_guard<std::mutex> lock(writeMutex);
+        mergeRecent(true);
+        State next = *state;
+        addRun(next, std::move(batch));
+        publish(std::move(next));
+    }
+
+    // Keys are normalized the same way as at load time, so the lookup is a binary search in the user's postings
+    void deleteMessage(const std::string& user, const std::string& time) {
+        std::lock_guard<std::mutex> lock(writeMutex);
+        mergeRecent(true);
+        int64_t timestamp;
+        bool found = false;
+        if (parseTimestamp(time, timestamp)) {
+            State next = *state;
+            found = deleteKey(next, trimUser(user), timestamp);
+            if (found) {
+                publish(std::move(next));
+            }
+        }
+        if (found) {
+            std::cout << "Message deleted successfully." << std::endl;
+        }
+        else {
+            std::cout << "Message not found for user: " << user << " at time: " << time << std::endl;
+        }
+    }
+
+    // Deletes a batch of (user, time) keys and publishes the result once. Returns the number of
+    // deleted messages.
+    size_t deleteMessages(const std::vector<std::pair<std::string, std::string>>& keys) {
+        std::lock_guard<std::mutex> lock(writeMutex);
+        mergeRecent(true);
+        State next = *state;
+        size_t removed = 0;
+        for (const auto& key : keys) {
+            int64_t timestamp;
+            if (parseTimestamp(key.second, timestamp) && deleteKey(next, trimUser(key.first), timestamp)) {
+                ++removed;
+            }
+        }
+        publish(std::move(next));
+        std::cout << removed << " of " << keys.size() << " messages deleted." << std::endl;
+        return removed;
+    }
+
+    void deleteMessagesByUser(const std::string& user) {
+        std::lock_guard<std::mutex> lock(writeMutex);
+        mergeRecent(true);
+        std::string_view name = trimUser(user);
+        State next = *state;
+        for (auto* segments : { &next.runs, &next.segments }) {
+            for (auto& segment : *segments) {
+                auto entries = segment.data().userEntries(name);
+                for (const uint32_t* entry = entries.first; entry != entries.second; ++entry) {
+                    markDeleted(segment, *entry);
+                }
+            }
+        }
+        publish(std::move(next));
+        std::cout << "All messages from user: " << user << " have been deleted." << std::endl;
+    }
+
+    void printMessagesByUser(const std::string& user) const {
+        MessageWriter out(std::cout, OutputFormat::Text);
+        out.writeAll(messagesByUser(user));
+    }
+
+    void printMessagesByUserInRange(const std::string& user, const std::string& startTime, const std::string& endTime) const {
+        int64_t start, end;
+        if (!parseRange(startTime, endTime, start, end)) {
+            return;
+        }
+        MessageWriter out(std::cout, OutputFormat::Text);
+        out.writeAll(messagesByUserInRange(user, start, end));
+    }
+
+    void printMessagesInRange(const std::string& startTime, const std::string& endTime) const {
+        int64_t start, end;
+        if (!parseRange(startTime, endTime, start, end)) {
+            return;
+        }
+        MessageWriter out(std::cout, OutputFormat::Text);
+        out.writeAll(messagesInRange(start, end));
+    }
+
+    // Prints messages containing all (matchAll) or any of the words of the query, in time order.
+    // An empty user or time bound means no filter on it. Memory runs and segments are answered by
+    // their text indexes; only the ingest buffers are scanned.
+    void printSearch(const std::string& query, bool matchAll, const std::string& user = std::string(),
+        const std::string& startTime = std::string(), const std::string& endTime = std::string()) const {
+        int64_t start = std::numeric_limits<int64_t>::min();
+        int64_t end = std::numeric_limits<int64_t>::max();
+        if ((!startTime.empty() && !parseTimestamp(startTime, start)) || (!endTime.empty() && !parseTimestamp(endTime, end))) {
+            std::cerr << "Invalid time range: " << startTime << " to " << endTime << std::endl;
+            return;
+        }
+        Snapshot view = snapshot();
+        const State& current = *view.state;
+        std::string_view name = trimUser(user);
+        std::vector<MessageRef> found;
+
+        // A run entry whose key is also in a segment is shown from the segment
+        auto searchIn = [&](const StoredSegment& segment, bool isRun) {
+            const Segment& data = segment.data();
+            if (data.maxTime() < start || data.minTime() > end || (!user.empty() && !data.mayContainUser(name))) {
+                return;
+            }
+            for (uint32_t entry : data.search(query, matchAll, start, end)) {
+                if (!segment.deleted->test(entry) && data.time(entry) >= start && data.time(entry) <= end
+                    && (user.empty() || data.user(entry) == name) && !(isRun && segmentsContain(current, data.time(entry), data.user(entry)))) {
+                    found.push_back(data.message(entry));
+                }
+            }
+        };
+        for (const auto& run : current.runs) {
+            searchIn(run, true);
+        }
+        auto span = segmentsOverlapping(current.segments, start, end);
+        for (size_t i = span.first; i < span.second; ++i) {
+            searchIn(current.segments[i], false);
+        }
+
+        std::vector<std::string> terms;
+        forEachToken(query, [&](std::string_view token) {
+            if (std::find(terms.begin(), terms.end(), token) == terms.end()) {
+                terms.emplace_back(token);
+            }
+            });
+        std::vector<bool> seen(terms.size());
+        auto matches = [&](std::string_view text) {
+            std::fill(seen.begin(), seen.end(), false);
+            forEachToken(text, [&](std::string_view token) {
+                auto it = std::find(terms.begin(), terms.end(), token);
+                if (it != terms.end()) {
+                    seen[static_cast<size_t>(it - terms.begin())] = true;
+                }
+                });
+            return matchAll ? std::find(seen.begin(), seen.end(), false) == seen.end() && !terms.empty()
+                : std::find(seen.begin(), seen.end(), true) != seen.end();
+        };
+
+        // The merge keeps only the first buffered copy of a key, and none if the key is stored
+        std::vector<MessageRef> recent = recentMessages(view.buffers, start, end, user.empty() ? nullptr : &name);
+        for (size_t i = 0; i < recent.size(); ++i) {
+            const MessageRef& msg = recent[i];
+            bool repeated = i > 0 && msg.time == recent[i - 1].time && msg.user == recent[i - 1].user;
+            if (!repeated && matches(msg.text) && !contains(current, msg.time, msg.user)) {
+                found.push_back(msg);
+            }
+        }
+
+        std::sort(found.begin(), found.end(), keyLess);
+        MessageWriter out(std::cout, OutputFormat::Text);
+        out.writeAll(found);
+    }
+
+    void printMessages() const {
+        MessageWriter out(std::cout, OutputFormat::Text);
+        out.writeAll(messages());
+    }
+
+    // Maps every segment of the directory; the messages already in memory stay where they are
+    void openSegments(const std::string& directory) {
+        std::lock_guard<std::mutex> lock(writeMutex);
+        segmentDirectory = directory;
+        std::filesystem::create_directories(directory);
+        State next = *state;
+        for (const auto& item : std::filesystem::directory_iterator(directory)) {
+            if (item.path().extension() != ".seg") {
+                continue;
+            }
+            std::string stem = item.path().stem().string();
+            try {
+                auto shared = std::make_shared<SharedSegment>();
+                shared->path = item.path().string();
+                shared->sequence = std::stoull(stem.substr(stem.rfind('-') + 1));
+                shared->data = std::make_unique<const Segment>(shared->path);
+                nextSequence = std::max(nextSequence, shared->sequence + 1);
+                next.segments.push_back(storedSegment(std::move(shared)));
+            }
+            catch (const std::exception& error) {
+                std::cerr << "Skipping segment " << item.path().string() << ": " << error.what() << std::endl;
+            }
+        }
+        sortSegments(next.segments);
+        publish(std::move(next));
+    }
+
+    // Moves the memory runs into new day segments and rewrites segments that have deletions into
+    // new files. The files replaced are removed once no query reads them. Returns the number of
+    // segment files written.
+    size_t flushSegments() {
+        std::lock_guard<std::mutex> lock(writeMutex);
+        mergeRecent(true);
+        if (segmentDirectory.empty()) {
+            std::cerr << "No segment directory is open." << std::endl;
+            return 0;
+        }
+        State next = *state;
+        std::vector<std::shared_ptr<const SharedSegment>> created;
+        std::vector<std::shared_ptr<const SharedSegment>> retired;
+        try {
+            std::vector<StoredSegment> kept;
+            for (auto& segment : next.segments) {
+                if (segment.dead == 0) {
+                    kept.push_back(std::move(segment));
+                    continue;
+                }
+                retired.push_back(segment.shared);
+                std::vector<MessageRef> live = liveMessages(segment);
+                if (!live.empty()) {
+                    kept.push_back(writeSegment(live));
+                    created.push_back(kept.back().shared);
+                }
+            }
+            next.segments = std::move(kept);
+            sortSegments(next.segments);
+
+            std::vector<MessageRef> memory;
+            for (const auto& run : next.runs) {
+                for (const MessageRef& msg : liveMessages(run)) {
+                    if (!segmentsContain(next, msg.time, msg.user)) {
+                        memory.push_back(msg);
+                    }
+                }
+            }
+            std::sort(memory.begin(), memory.end(), keyLess);
+            std::vector<MessageRef> day;
+            std::vector<StoredSegment> fresh;
+            auto writeDay = [&]() {
+                if (day.empty()) {
+                    return;
+                }
+                fresh.push_back(writeSegment(day));
+                created.push_back(fresh.back().shared);
+                day.clear();
+            };
+            for (const MessageRef& msg : memory) {
+                if (!day.empty() && dayOf(day.front().time) != dayOf(msg.time)) {
+                    writeDay();
+                }
+                day.push_back(msg);
+            }
+            writeDay();
+            std::move(fresh.begin(), fresh.end(), std::back_inserter(next.segments));
+            next.runs.clear();
+        }
+        catch (...) {
+            for (const auto& segment : created) {
+                segment->obsolete = true;
+            }
+            throw;
+        }
+        sortSegments(next.segments);
+        publish(std::move(next));
+        for (const auto& segment : retired) {
+            segment->obsolete = true;
+        }
+        return created.size();
+    }
+
+    // Retention: removes the segments whose messages are all older than the given time
+    size_t dropSegmentsBefore(const std::string& time) {
+        std::lock_guard<std::mutex> lock(writeMutex);
+        int64_t cutoff;
+        if (!parseTimestamp(time, cutoff)) {
+            std::cerr << "Invalid time: " << time << std::endl;
+            return 0;
+        }
+        State next = *state;
+        std::vector<StoredSegment> kept;
+        std::vector<std::shared_ptr<const SharedSegment>> dropped;
+        for (auto& segment : next.segments) {
+            if (segment.data().maxTime() < cutoff) {
+                dropped.push_back(segment.shared);
+            }
+            else {
+                kept.push_back(std::move(segment));
+            }
+        }
+        next.segments = std::move(kept);
+        publish(std::move(next));
+        for (const auto& segment : dropped) {
+            segment->obsolete = true;
+        }
+        return dropped.size();
+    }
+
+    // Live messages in memory; the ingest buffers are merged first so that just added messages
+    // are counted
+    size_t size() {
+        std::lock_guard<std::mutex> lock(writeMutex);
+        mergeRecent(true);
+        size_t live = 0;
+        for (const auto& run : state->runs) {
+            live += run.live();
+        }
+        return live;
+    }
+
+    // Approximate heap bytes held for the memory runs and the tombstones. Mapped segments are
+    // not counted; ingest buffers are counted by capacity.
+    size_t memoryUsage() const {
+        Snapshot view = snapshot();
+        size_t bytes = 0;
+        for (const auto* segments : { &view.state->runs, &view.state->segments }) {
+            for (const auto& segment : *segments) {
+                bytes += sizeof(StoredSegment) + sizeof(SharedSegment) + segment.data().memoryUsage() + segment.deleted->memoryUsage();
+            }
+        }
+        bytes += view.buffers.size() * IngestBuffer::CAPACITY * (2 * sizeof(std::string) + sizeof(int64_t) + sizeof(std::atomic<bool>));
+        return bytes;
+    }
+
+    // Stores messages sorted by (time, user) directly as new segments, one per day; keys already
+    // in the store are skipped. Used by the external merge, which streams its output here instead
+    // of through the memory runs. Returns the number of messages written.
+    size_t addSegment(const std::vector<MessageRef>& messages) {
+        std::lock_guard<std::mutex> lock(writeMutex);
+        mergeRecent(true);
+        if (segmentDirectory.empty()) {
+            std::cerr << "No segment directory is open." << std::endl;
+            return 0;
+        }
+        State next = *state;
+        size_t stored = 0;
+        std::vector<MessageRef> fresh;
+        auto writeDay = [&]() {
+            if (fresh.empty()) {
+                return;
+            }
+            StoredSegment segment = writeSegment(fresh);
+            auto position = std::upper_bound(next.segments.begin(), next.segments.end(), segment, segmentBefore);
+            next.segments.insert(position, std::move(segment));
+            stored += fresh.size();
+            fresh.clear();
+        };
+        // The days written before a failure are kept, as their files are
+        try {
+            for (const auto& msg : messages) {
+                if (!fresh.empty() && dayOf(fresh.front().time) != dayOf(msg.time)) {
+                    writeDay();
+                }
+                if (!contains(next, msg.time, msg.user)) {
+                    fresh.push_back(msg);
+                }
+            }
+            writeDay();
+        }
+        catch (...) {
+            publish(std::move(next));
+            throw;
+        }
+        publish(std::move(next));
+        return stored;
+    }
+
+private:
+    // The data of a segment file or a memory run (with an empty path), shared by every state that
+    // holds it. A writer that drops a segment marks it obsolete; the file is removed when the last
+    // state holding it is gone, so queries on older states keep reading the mapping until then.
+    struct SharedSegment {
+        std::unique_ptr<const Segment> data;
+        std::string path;
+        uint64_t sequence = 0;
+        mutable std::atomic<bool> obsolete{ false };
+
+        ~SharedSegment() {
+            data.reset();
+            if (obsolete && !path.empty()) {
+                std::error_code ignored;
+                std::filesystem::remove(path, ignored);
+            }
+        }
+    };
+
+    // A segment or memory run as held by one state. The tombstones are shared with older states
+    // until a writer marks an entry, which copies them first (see markDeleted).
+    struct StoredSegment {
+        std::shared_ptr<const SharedSegment> shared;
+        std::shared_ptr<Tombstones> deleted;
+        size_t dead = 0;
+
+        const Segment& data() const {
+            return *shared->data;
+        }
+
+        size_t live() const {
+            return data().size() - dead;
+        }
+    };
+
+    // Runs hold the merged ingest buffers and batches, oldest first, and never share a live key.
+    // Segments are sorted by (minTime, sequence), each within one day, and never share a key
+    // either. A run may repeat a key of a segment; the segment's message is the one shown, and
+    // the run's is dropped when the runs are flushed.
+    struct State {
+        std::vector<StoredSegment> runs;
+        std::vector<StoredSegment> segments;
+    };
+
+    // Writers hold writeMutex while they build and publish the next state. publishMutex guards
+    // the published state together with the list of full buffers waiting for the merger, so
+    // a snapshot sees each message either in the state or in a buffer, and the merger's wake-up
+    // flags. The active buffer is read and swapped atomically, and only swapped under
+    // publishMutex.
+    std::mutex writeMutex;
+    mutable std::mutex publishMutex;
+    std::shared_ptr<const State> state = std::make_shared<const State>();
+    std::shared_ptr<IngestBuffer> active = std::make_shared<IngestBuffer>();
+    std::vector<std::shared_ptr<IngestBuffer>> frozen;
+    std::condition_variable mergeNeeded;
+    bool rebuildNeeded = false;
+    std::atomic<bool> stopping{ false };
+    std::thread merger;
+
+    std::string segmentDirectory;
+    uint64_t nextSequence = 0;
+
+    static constexpr size_t RUN_FAN_IN = 8;
+
+    Snapshot snapshot() const {
+        std::lock_guard<std::mutex> lock(publishMutex);
+        Snapshot view{ state, frozen };
+        view.buffers.push_back(std::atomic_load(&active));
+        return view;
+    }
+
+    // Makes next the state seen by queries. The first merged buffers of the frozen list leave it
+    // at the same moment, as their messages are in next. The replaced state is released after the
+    // lock, since that may unmap and remove segment files.
+    void publish(State next, size_t merged = 0) {
+        bool rebuild = !rebuildGroup(next.runs).empty();
+        std::shared_ptr<const State> previous = std::make_shared<const State>(std::move(next));
+        std::lock_guard<std::mutex> lock(publishMutex);
+        state.swap(previous);
+        frozen.erase(frozen.begin(), frozen.begin() + static_cast<std::ptrdiff_t>(merged));
+        if (rebuild) {
+            rebuildNeeded = true;
+            mergeNeeded.notify_one();
+        }
+    }
+
+    // Body of the merger thread: merges the full buffers that producers queue into runs, then
+    // rebuilds runs (see rebuildRuns). After an error the buffers stay queued, and the next
+    // writer merges them.
+    void mergeLoop() {
+        std::unique_lock<std::mutex> lock(publishMutex);
+        while (true) {
+            mergeNeeded.wait(lock, [this]() { return stopping || rebuildNeeded || !frozen.empty(); });
+            if (stopping) {
+                return;
+            }
+            rebuildNeeded = false;
+            lock.unlock();
+            try {
+                {
+                    std::lock_guard<std::mutex> writer(writeMutex);
+                    mergeRecent(false);
+                }
+                while (!stopping && rebuildRuns()) {
+                }
+            }
+            catch (const std::exception& error) {
+                std::cerr << "Error merging messages: " << error.what() << std::endl;
+                return;
+            }
+            lock.lock();
+        }
+    }
+
+    // Moves the full ingest buffers, and the active one when sealActive is set, into a memory run.
+    // Requires writeMutex.
+    void mergeRecent(bool sealActive) {
+        std::vector<std::shared_ptr<IngestBuffer>> pending;
+        {
+            std::lock_guard<std::mutex> lock(publishMutex);
+            std::shared_ptr<IngestBuffer> current = std::atomic_load(&active);
+            if (sealActive && !current->empty()) {
+                std::atomic_store(&active, std::make_shared<IngestBuffer>());
+                frozen.push_back(current);
+            }
+            pending = frozen;
+        }
+        if (pending.empty()) {
+            return;
+        }
+        std::vector<MessageRef> messages;
+        for (const auto& buffer : pending) {
+            buffer->seal();
+            buffer->forEachReady([&messages](const MessageRef& msg) { messages.push_back(msg); });
+        }
+        State next = *state;
+        addRun(next, std::move(messages));
+        publish(std::move(next), pending.size());
+    }
+
+    // Messages of the ingest buffers in [start, end] (of one user, if given), sorted by (time, user)
+    // with arrival order kept on equal keys; the views stay valid while the buffers are held
+    static std::vector<MessageRef> recentMessages(const std::vector<std::shared_ptr<IngestBuffer>>& buffers,
+        int64_t start, int64_t end, const std::string_view* user) {
+        std::vector<MessageRef> messages;
+        for (const auto& buffer : buffers) {
+            buffer->forEachReady([&](const MessageRef& msg) {
+                if (msg.time >= start && msg.time <= end && (user == nullptr || msg.user == *user)) {
+                    messages.push_back(msg);
+                }
+                });
+        }
+        std::stable_sort(messages.begin(), messages.end(), keyLess);
+        return messages;
+    }
+
+    // Stores the messages as a new run of next: a repeated key keeps only its first message, and
+    // keys already in a run are dropped
+    static void addRun(State& next, std::vector<MessageRef> messages) {
+        if (!std::is_sorted(messages.begin(), messages.end(), keyLess)) {
+            std::stable_sort(messages.begin(), messages.end(), keyLess);
+        }
+        messages.erase(std::unique(messages.begin(), messages.end(), [](const MessageRef& a, const MessageRef& b) {
+            return a.time == b.time && a.user == b.user;
+            }), messages.end());
+        messages.erase(std::remove_if(messages.begin(), messages.end(), [&next](const MessageRef& msg) {
+            return runsContain(next, msg.time, msg.user);
+            }), messages.end());
+        if (!messages.empty()) {
+            next.runs.push_back(makeRun(messages));
+        }
+    }
+
+    // The positions of the runs to rebuild next, or none. Once RUN_FAN_IN runs of a size class
+    // exist, they are merged into one. A class spans a factor of RUN_FAN_IN in live messages, and
+    // runs smaller than an ingest buffer count as the smallest class, so fewer than RUN_FAN_IN
+    // runs of each class remain and a message is merged about once per class it passes through.
+    // Otherwise a run that is mostly tombstones is rebuilt without them.
+    static std::vector<size_t> rebuildGroup(const std::vector<StoredSegment>& runs) {
+        auto sizeClass = [](const StoredSegment& run) {
+            size_t level = 0;
+            for (size_t live = run.live() / IngestBuffer::CAPACITY; live > 0; live /= RUN_FAN_IN) {
+                ++level;
+            }
+            return level;
+        };
+        std::vector<size_t> counts;
+        for (const auto& run : runs) {
+            size_t level = sizeClass(run);
+            counts.resize(std::max(counts.size(), level + 1));
+            if (++counts[level] == RUN_FAN_IN) {
+                std::vector<size_t> group;
+                for (size_t i = 0; i < runs.size(); ++i) {
+                    if (sizeClass(runs[i]) == level) {
+                        group.push_back(i);
+                    }
+                }
+                return group;
+            }
+        }
+        for (size_t i = 0; i < runs.size(); ++i) {
+            if (runs[i].dead * 2 > runs[i].data().size()) {
+                return { i };
+            }
+        }
+        return {};
+    }
+
+    // Replaces one group of runs (see rebuildGroup) with a run of their live messages. The new
+    // run is built without writeMutex, so writers do not wait for it; deletions made meanwhile
+    // are carried over when it is swapped in. Runs never share a live key, so their order is
+    // free. Returns false when nothing needs rebuilding.
+    bool rebuildRuns() {
+        std::shared_ptr<const State> base;
+        {
+            std::lock_guard<std::mutex> writer(writeMutex);
+            base = state;
+        }
+        std::vector<size_t> group = rebuildGroup(base->runs);
+        if (group.empty()) {
+            return false;
+        }
+        std::vector<MessageRef> merged;
+        for (size_t i : group) {
+            std::vector<MessageRef> live = liveMessages(base->runs[i]);
+            merged.insert(merged.end(), live.begin(), live.end());
+        }
+        std::sort(merged.begin(), merged.end(), keyLess);
+        std::vector<StoredSegment> rebuilt;
+        if (!merged.empty()) {
+            rebuilt.push_back(makeRun(merged));
+        }
+
+        std::lock_guard<std::mutex> writer(writeMutex);
+        State next = *state;
+        for (size_t i : group) {
+            const StoredSegment& before = base->runs[i];
+            auto it = std::find_if(next.runs.begin(), next.runs.end(),
+                [&](const StoredSegment& run) { return run.shared == before.shared; });
+            if (it == next.runs.end()) {
+                // A flush took the run meanwhile; the caller looks at the new state again
+                return true;
+            }
+            for (size_t entry = 0; it->dead != before.dead && entry < before.data().size(); ++entry) {
+                if (it->deleted->test(entry) && !before.deleted->test(entry) && !rebuilt.empty()) {
+                    deleteFromSegment(rebuilt.front(), before.data().user(entry), before.data().time(entry));
+                }
+            }
+            next.runs.erase(it);
+        }
+        if (!rebuilt.empty() && rebuilt.front().live() > 0) {
+            next.runs.push_back(std::move(rebuilt.front()));
+        }
+        publish(std::move(next));
+        return true;
+    }
+
+    static StoredSegment makeRun(const std::vector<MessageRef>& messages) {
+        auto shared = std::make_shared<SharedSegment>();
+        shared->data = std::make_unique<const Segment>(messages);
+        return storedSegment(std::move(shared));
+    }
 
-    Message(const std::string& u, const std::string& t, const std::string& m)
-        : user(u), time(t), text(m) {}
+    static StoredSegment storedSegment(std::shared_ptr<const SharedSegment> shared) {
+        StoredSegment segment;
+        segment.deleted = std::make_shared<Tombstones>(shared->data->size());
+        segment.shared = std::move(shared);
+        return segment;
+    }
 
-    bool operator<(const Message& other) const {
-        if (time == other.time) {
-            return user < other.user;
+    // The live messages of a segment or run in (time, user) order
+    static std::vector<MessageRef> liveMessages(const StoredSegment& segment) {
+        std::vector<MessageRef> live;
+        live.reserve(segment.live());
+        for (size_t entry = 0; entry < segment.data().size(); ++entry) {
+            if (!segment.deleted->test(entry)) {
+                live.push_back(segment.data().message(entry));
+            }
         }
-        return time < other.time;
+        return live;
     }
-};
 
-class MessageStore {
-public:
-    void addMessage(const std::string& user, const std::string& time, const std::string& text) {
-        messages.emplace(user, time, text);
+    // Writes and maps the file of a new segment named after its day. A file that cannot be mapped
+    // is removed with the segment.
+    StoredSegment writeSegment(const std::vector<MessageRef>& day) {
+        auto shared = std::make_shared<SharedSegment>();
+        shared->sequence = nextSequence++;
+        shared->path = (std::filesystem::path(segmentDirectory)
+            / (formatTimestamp(day.front().time).substr(0, 10) + "-" + std::to_string(shared->sequence) + ".seg")).string();
+        Segment::write(shared->path + ".tmp", day);
+        std::filesystem::rename(shared->path + ".tmp", shared->path);
+        shared->obsolete = true;
+        shared->data = std::make_unique<const Segment>(shared->path);
+        shared->obsolete = false;
+        return storedSegment(std::move(shared));
     }
 
-    void deleteMessage(const std::string& user, const std::string& time) {
-        auto it = std::find_if(messages.begin(), messages.end(), [&](const Message& msg) {
-            std::string cleanMsgTime = msg.time;
-            cleanMsgTime.erase(std::remove_if(cleanMsgTime.begin(), cleanMsgTime.end(), ::isspace), cleanMsgTime.end());
-            std::string cleanDelTime = time;
-            cleanDelTime.erase(std::remove_if(cleanDelTime.begin(), cleanDelTime.end(), ::isspace), cleanDelTime.end());
-            return msg.user == user && cleanMsgTime == cleanDelTime;
-            });
+    static int64_t dayOf(int64_t time) {
+        return (time >= 0 ? time : time - 86399999) / 86400000;
+    }
 
-        if (it != messages.end()) {
-            messages.erase(it);
-            std::cout << "Message deleted successfully." << std::endl;
+    static bool keyLess(const MessageRef& a, const MessageRef& b) {
+        return a.time != b.time ? a.time < b.time : a.user < b.user;
+    }
+
+    static std::string_view trimUser(std::string_view user) {
+        size_t first = user.find_first_not_of(" \t\r\n");
+        if (first == std::string_view::npos) {
+            return std::string_view();
         }
-        else {
-            std::cout << "Message not found for user: " << user << " at time: " << time << std::endl;
+        return user.substr(first, user.find_last_not_of(" \t\r\n") - first + 1);
+    }
+
+    // Marks an entry of a segment in a state being built. Tombstones still shared with a
+    // published state are copied first; Tombstones::set copies the chunk it changes.
+    static bool markDeleted(StoredSegment& segment, size_t entry) {
+        if (segment.deleted->test(entry)) {
+            return false;
         }
+        if (segment.deleted.use_count() > 1) {
+            segment.deleted = std::make_shared<Tombstones>(*segment.deleted);
+        }
+        segment.deleted->set(entry);
+        ++segment.dead;
+        return true;
     }
 
-    void deleteMessagesByUser(const std::string& user) {
-        auto it = messages.begin();
-        while (it != messages.end()) {
-            if (it->user == user) {
-                it = messages.erase(it);
-            }
-            else {
-                ++it;
+    // Finds the live entry of (user, time) in the segment
+    static bool findInSegment(const StoredSegment& segment, std::string_view user, int64_t time, size_t& entry) {
+        const Segment& data = segment.data();
+        if (time < data.minTime() || time > data.maxTime() || !data.mayContainUser(user)) {
+            return false;
+        }
+        auto entries = data.userEntries(user);
+        const uint32_t* it = std::lower_bound(entries.first, entries.second, time,
+            [&](uint32_t candidate, int64_t value) { return data.time(candidate) < value; });
+        if (it == entries.second || data.time(*it) != time || segment.deleted->test(*it)) {
+            return false;
+        }
+        entry = *it;
+        return true;
+    }
+
+    static bool deleteFromSegment(StoredSegment& segment, std::string_view user, int64_t time) {
+        size_t entry;
+        return findInSegment(segment, user, time, entry) && markDeleted(segment, entry);
+    }
+
+    // Deletes the key from every run and segment of next that holds it
+    static bool deleteKey(State& next, std::string_view user, int64_t time) {
+        bool found = false;
+        for (auto& run : next.runs) {
+            found = deleteFromSegment(run, user, time) || found;
+        }
+        auto span = segmentsOverlapping(next.segments, time, time);
+        for (size_t i = span.first; i < span.second; ++i) {
+            found = deleteFromSegment(next.segments[i], user, time) || found;
+        }
+        return found;
+    }
+
+    static bool contains(const State& current, int64_t time, std::string_view user) {
+        return runsContain(current, time, user) || segmentsContain(current, time, user);
+    }
+
+    static bool runsContain(const State& current, int64_t time, std::string_view user) {
+        size_t entry;
+        for (const auto& run : current.runs) {
+            if (findInSegment(run, user, time, entry)) {
+                return true;
             }
         }
-        std::cout << "All messages from user: " << user << " have been deleted." << std::endl;
+        return false;
     }
 
-    void printMessagesByUser(const std::string& user) const {
-        for (const auto& msg : messages) {
-            if (msg.user == user) {
-                std::cout << msg.user << " " << msg.time << ": " << msg.text << std::endl;
+    static bool segmentsContain(const State& current, int64_t time, std::string_view user) {
+        size_t entry;
+        auto span = segmentsOverlapping(current.segments, time, time);
+        for (size_t i = span.first; i < span.second; ++i) {
+            if (findInSegment(current.segments[i], user, time, entry)) {
+                return true;
             }
         }
+        return false;
     }
 
-    void printMessagesByUserInRange(const std::string& user, const std::string& startTime, const std::string& endTime) const {
-        for (const auto& msg : messages) {
-            if (msg.user == user && msg.time >= startTime && msg.time <= endTime) {
-                std::cout << msg.user << " " << msg.time << ": " << msg.text << std::endl;
+    static bool segmentBefore(const StoredSegment& a, const StoredSegment& b) {
+        int64_t x = a.data().minTime();
+        int64_t y = b.data().minTime();
+        return x != y ? x < y : a.shared->sequence < b.shared->sequence;
+    }
+
+    static void sortSegments(std::vector<StoredSegment>& segments) {
+        std::sort(segments.begin(), segments.end(), segmentBefore);
+    }
+
+    // Positions [first, last) of the segments that may hold times of [start, end]. Every segment
+    // lies within one day and the list is sorted by minTime, so these are the segments that
+    // start between the beginning of start's day and end; a binary search finds them.
+    static std::pair<size_t, size_t> segmentsOverlapping(const std::vector<StoredSegment>& segments, int64_t start, int64_t end) {
+        int64_t dayStart = start < std::numeric_limits<int64_t>::min() + 86400000
+            ? std::numeric_limits<int64_t>::min() : dayOf(start) * 86400000;
+        auto first = std::lower_bound(segments.begin(), segments.end(), dayStart,
+            [](const StoredSegment& segment, int64_t value) { return segment.data().minTime() < value; });
+        auto last = std::upper_bound(first, segments.end(), end,
+            [](int64_t value, const StoredSegment& segment) { return value < segment.data().minTime(); });
+        return { static_cast<size_t>(first - segments.begin()), static_cast<size_t>(last - segments.begin()) };
+    }
+
+    static int64_t bucketStart(int64_t time, int64_t bucketMillis) {
+        int64_t bucket = time / bucketMillis;
+        if (time % bucketMillis < 0) {
+            --bucket;
+        }
+        return bucket * bucketMillis;
+    }
+
+    // Splits [start, end], narrowed to the stored times, into one time slice per hardware thread,
+    // with slice borders on multiples of align. Each slice of the snapshot is merged and folded on
+    // its own thread with fold(partial, msg); the partials come back in time order. Since the
+    // slices do not overlap, neither do their keys, and buckets of width align never straddle two
+    // partials. Views in the partials stay valid while the caller holds the snapshot.
+    template <typename Partial, typename Fold>
+    static std::vector<Partial> aggregateSlices(const Snapshot& view, int64_t start, int64_t end, int64_t align, Fold fold) {
+        int64_t first = std::numeric_limits<int64_t>::max();
+        int64_t last = std::numeric_limits<int64_t>::min();
+        for (const auto* segments : { &view.state->runs, &view.state->segments }) {
+            for (const auto& segment : *segments) {
+                if (segment.data().size() > 0) {
+                    first = std::min(first, segment.data().minTime());
+                    last = std::max(last, segment.data().maxTime());
+                }
             }
         }
+        std::vector<MessageRef> recent = recentMessages(view.buffers, start, end, nullptr);
+        if (!recent.empty()) {
+            first = std::min(first, recent.front().time);
+            last = std::max(last, recent.back().time);
+        }
+        first = std::max(first, start);
+        last = std::min(last, end);
+        if (first > last) {
+            return {};
+        }
+
+        align = std::max<int64_t>(align, 1);
+        int64_t base = bucketStart(first, align);
+        int64_t slices = std::max(1u, std::thread::hardware_concurrency());
+        int64_t width = (last - base) / slices + 1;
+        width = (width + align - 1) / align * align;
+
+        std::vector<std::future<Partial>> pending;
+        for (int64_t sliceStart = base; sliceStart <= last; sliceStart += width) {
+            int64_t low = std::max(sliceStart, first);
+            int64_t high = std::min(last, sliceStart + (width - 1));
+            pending.push_back(std::async(std::launch::async, [&view, low, high, &fold]() {
+                Partial partial;
+                for (const MessageRef& msg : Range(view, low, high, nullptr)) {
+                    fold(partial, msg);
+                }
+                return partial;
+                }));
+            if (last - sliceStart < width) {
+                break;
+            }
+        }
+        std::vector<Partial> partials;
+        for (auto& slice : pending) {
+            partials.push_back(slice.get());
+        }
+        return partials;
     }
 
-    void printMessagesInRange(const std::string& startTime, const std::string& endTime) const {
-        for (const auto& msg : messages) {
-            if (msg.time >= startTime && msg.time <= endTime) {
-                std::cout << msg.user << " " << msg.time << ": " << msg.text << std::endl;
+    // Messages per user in [start, end]; the names view the snapshot
+    static std::unordered_map<std::string_view, size_t> userTotals(const Snapshot& view, int64_t start, int64_t end) {
+        using Totals = std::unordered_map<std::string_view, size_t>;
+        auto fold = [](Totals& totals, const MessageRef& msg) { ++totals[msg.user]; };
+        Totals result;
+        for (const Totals& partial : aggregateSlices<Totals>(view, start, end, 1, fold)) {
+            for (const auto& entry : partial) {
+                result[entry.first] += entry.second;
             }
         }
+        return result;
     }
 
-    void printMessages() const {
-        for (const auto& msg : messages) {
-            std::cout << msg.user << " " << msg.time << ": " << msg.text << std::endl;
+    static bool parseRange(const std::string& startTime, const std::string& endTime, int64_t& start, int64_t& end) {
+        if (!parseTimestamp(startTime, start) || !parseTimestamp(endTime, end)) {
+            std::cerr << "Invalid time range: " << startTime << " to " << endTime << std::endl;
+            return false;
+        }
+        return true;
+    }
+};
+
+// Calls visit(line, lineNumber) for every line of the buffer; a trailing '\r' is dropped
+template <typename Visitor>
+void forEachLine(std::string_view buffer, Visitor visit) {
+    size_t lineNumber = 0;
+    while (!buffer.empty()) {
+        const char* newline = static_cast<const char*>(std::memchr(buffer.data(), '\n', buffer.size()));
+        size_t length = newline == nullptr ? buffer.size() : static_cast<size_t>(newline - buffer.data());
+        std::string_view line = buffer.substr(0, length);
+        if (!line.empty() && line.back() == '\r') {
+            line.remove_suffix(1);
+        }
+        visit(line, ++lineNumber);
+        buffer.remove_prefix(newline == nullptr ? length : length + 1);
+    }
+}
+
+inline bool isMessageSpace(char c) {
+    return c == ' ' || (c >= '\t' && c <= '\r');
+}
+
+// Splits "user time: text" the way the regex (\S+)\s+(\S+):\s+(.+) did, without copying anything:
+// the time is the second word without its final ':', the text is the rest of the line after the spaces
+bool parseMessageLine(std::string_view line, std::string_view& user, std::string_view& time, std::string_view& text) {
+    size_t pos = 0;
+    while (pos < line.size() && !isMessageSpace(line[pos])) {
+        ++pos;
+    }
+    if (pos == 0 || pos == line.size()) {
+        return false;
+    }
+    user = line.substr(0, pos);
+
+    size_t timeStart = pos;
+    while (timeStart < line.size() && isMessageSpace(line[timeStart])) {
+        ++timeStart;
+    }
+    size_t timeEnd = timeStart;
+    while (timeEnd < line.size() && !isMessageSpace(line[timeEnd])) {
+        ++timeEnd;
+    }
+    if (timeEnd - timeStart < 2 || line[timeEnd - 1] != ':' || timeEnd == line.size()) {
+        return false;
+    }
+    time = line.substr(timeStart, timeEnd - timeStart - 1);
+
+    size_t textStart = timeEnd;
+    while (textStart < line.size() && isMessageSpace(line[textStart])) {
+        ++textStart;
+    }
+    if (textStart == line.size()) {
+        // The regex lets the text be the last of two or more trailing spaces
+        if (textStart - timeEnd < 2) {
+            return false;
+        }
+        --textStart;
+    }
+    text = line.substr(textStart);
+    return true;
+}
+
+class ThreadPool {
+public:
+    explicit ThreadPool(unsigned workerCount) {
+        if (workerCount == 0) {
+            workerCount = 1;
+        }
+        for (unsigned i = 0; i < workerCount; ++i) {
+            workers.emplace_back([this]() {
+                while (true) {
+                    std::function<void()> task;
+                    {
+                        std::unique_lock<std::mutex> lock(tasksMutex);
+                        tasksAvailable.wait(lock, [this]() { return stopping || !tasks.empty(); });
+                        if (stopping && tasks.empty()) {
+                            return;
+                        }
+                        task = std::move(tasks.front());
+                        tasks.pop();
+                    }
+                    task();
+                }
+                });
+        }
+    }
+
+    ~ThreadPool() {
+        {
+            std::lock_guard<std::mutex> lock(tasksMutex);
+            stopping = true;
+        }
+        tasksAvailable.notify_all();
+        for (auto& worker : workers) {
+            worker.join();
+        }
+    }
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    template <typename Task>
+    auto submit(Task task) -> std::future<decltype(task())> {
+        using Result = decltype(task());
+        auto packaged = std::make_shared<std::packaged_task<Result()>>(std::move(task));
+        std::future<Result> result = packaged->get_future();
+        {
+            std::lock_guard<std::mutex> lock(tasksMutex);
+            tasks.emplace([packaged]() { (*packaged)(); });
         }
+        tasksAvailable.notify_one();
+        return result;
     }
 
 private:
-    std::set<Message> messages;
+    std::vector<std::thread> workers;
+    std::queue<std::function<void()>> tasks;
+    std::mutex tasksMutex;
+    std::condition_variable tasksAvailable;
+    bool stopping = false;
+};
+
+// Views into the mapped file of the run that produced the message
+struct ParsedMessage {
+    std::string_view user;
+    int64_t time;
+    std::string_view text;
+};
+
+// One file parsed into a run sorted by (time, user); lines with equal keys keep their file order
+struct MessageRun {
+    std::unique_ptr<MappedFile> file;
+    std::vector<ParsedMessage> messages;
+    std::string errors;
 };
 
+MessageRun parseMessageFile(const std::string& filename) {
+    MessageRun run;
+    try {
+        run.file = std::make_unique<MappedFile>(filename);
+    }
+    catch (const std::runtime_error& error) {
+        run.errors = std::string(error.what()) + "\n";
+        return run;
+    }
+
+    std::string_view buffer = run.file->view();
+    run.messages.reserve(std::count(buffer.begin(), buffer.end(), '\n') + 1);
+    forEachLine(buffer, [&](std::string_view line, size_t lineNumber) {
+        ParsedMessage msg;
+        std::string_view time;
+        if (!parseMessageLine(line, msg.user, time, msg.text)) {
+            run.errors += filename + ":" + std::to_string(lineNumber) + ": Invalid message format\n";
+        }
+        else if (!parseTimestamp(time, msg.time)) {
+            run.errors += filename + ":" + std::to_string(lineNumber) + ": Invalid message time: " + std::string(time) + "\n";
+        }
+        else {
+            run.messages.push_back(msg);
+        }
+        });
+
+    std::stable_sort(run.messages.begin(), run.messages.end(), [](const ParsedMessage& a, const ParsedMessage& b) {
+        return a.time != b.time ? a.time < b.time : a.user < b.user;
+        });
+    return run;
+}
+
+// Parses the files concurrently and merges the sorted runs into the store in (time, user) order.
+// On equal keys the earlier file wins, as if the files had been loaded one after another.
+void loadMessagesFromFiles(const std::vector<std::string>& filenames, MessageStore& store,
+    unsigned threads = std::thread::hardware_concurrency()) {
+    std::vector<MessageRun> runs;
+    {
+        ThreadPool pool(std::min<unsigned>(threads == 0 ? 1 : threads, static_cast<unsigned>(std::max<size_t>(filenames.size(), 1))));
+        std::vector<std::future<MessageRun>> pending;
+        for (const auto& filename : filenames) {
+            pending.push_back(pool.submit([filename]() { return parseMessageFile(filename); }));
+        }
+        for (auto& result : pending) {
+            runs.push_back(result.get());
+        }
+    }
+
+    size_t total = 0;
+    for (const auto& run : runs) {
+        std::cerr << run.errors;
+        total += run.messages.size();
+    }
+
+    using Cursor = std::pair<size_t, size_t>;
+    auto after = [&runs](const Cursor& a, const Cursor& b) {
+        const ParsedMessage& x = runs[a.first].messages[a.second];
+        const ParsedMessage& y = runs[b.first].messages[b.second];
+        if (x.time != y.time) {
+            return x.time > y.time;
+        }
+        if (x.user != y.user) {
+            return x.user > y.user;
+        }
+        return a.first > b.first;
+    };
+    std::priority_queue<Cursor, std::vector<Cursor>, decltype(after)> heads(after);
+    for (size_t i = 0; i < runs.size(); ++i) {
+        if (!runs[i].messages.empty()) {
+            heads.emplace(i, 0);
+        }
+    }
+    store.addBatch(total, [&](auto add) {
+        while (!heads.empty()) {
+            Cursor cursor = heads.top();
+            heads.pop();
+            const ParsedMessage& msg = runs[cursor.first].messages[cursor.second];
+            add(msg.user, msg.time, msg.text);
+            if (++cursor.second < runs[cursor.first].messages.size()) {
+                heads.push(cursor);
+            }
+        }
+        });
+}
+
 void loadMessagesFromFile(const std::string& filename, MessageStore& store) {
-    std::ifstream file(filename);
-    if (!file) {
-        std::cerr << "Error opening file: " << filename << std::endl;
-        return;
+    loadMessagesFromFiles({ filename }, store, 1);
+}
+
+// Sorted run of messages spilled to disk by the external merge. A record is the time (8 bytes),
+// the user and text lengths (4 bytes each) and then the user and text bytes, in host byte order.
+class SpillWriter {
+public:
+    explicit SpillWriter(const std::string& filename) : path(filename), output(filename, std::ios::binary | std::ios::trunc) {
+        if (!output) {
+            throw std::runtime_error("Error opening file: " + path);
+        }
+        block.reserve(BLOCK_SIZE);
     }
 
-    std::string line;
+    void write(int64_t time, std::string_view user, std::string_view text) {
+        uint32_t lengths[2] = { static_cast<uint32_t>(user.size()), static_cast<uint32_t>(text.size()) };
+        block.append(reinterpret_cast<const char*>(&time), sizeof(time));
+        block.append(reinterpret_cast<const char*>(lengths), sizeof(lengths));
+        block.append(user.data(), user.size());
+        block.append(text.data(), text.size());
+        if (block.size() >= BLOCK_SIZE) {
+            drain();
+        }
+    }
+
+    void close() {
+        drain();
+        output.close();
+        if (!output) {
+            throw std::runtime_error("Error writing file: " + path);
+        }
+    }
+
+private:
+    static constexpr size_t BLOCK_SIZE = 1 << 20;
+
+    void drain() {
+        output.write(block.data(), static_cast<std::streamsize>(block.size()));
+        block.clear();
+    }
+
+    std::string path;
+    std::ofstream output;
+    std::string block;
+};
+
+class SpillReader {
+public:
+    explicit SpillReader(const std::string& path) : buffer(BUFFER_SIZE) {
+        input.rdbuf()->pubsetbuf(buffer.data(), static_cast<std::streamsize>(buffer.size()));
+        input.open(path, std::ios::binary);
+        if (!input) {
+            throw std::runtime_error("Error opening file: " + path);
+        }
+    }
+
+    // Reads the next record; the views of the previous message become invalid
+    bool next() {
+        uint32_t lengths[2];
+        if (!input.read(reinterpret_cast<char*>(&message.time), sizeof(message.time))
+            || !input.read(reinterpret_cast<char*>(lengths), sizeof(lengths))) {
+            return false;
+        }
+        record.resize(static_cast<size_t>(lengths[0]) + lengths[1]);
+        if (!input.read(&record[0], static_cast<std::streamsize>(record.size()))) {
+            throw std::runtime_error("Truncated spill run");
+        }
+        message.user = std::string_view(record).substr(0, lengths[0]);
+        message.text = std::string_view(record).substr(lengths[0]);
+        return true;
+    }
+
+    const MessageRef& current() const {
+        return message;
+    }
+
+private:
+    static constexpr size_t BUFFER_SIZE = 1 << 18;
+
+    std::vector<char> buffer;
+    std::ifstream input;
+    std::string record;
+    MessageRef message{};
+};
+
+// Merges spill runs in (time, user) order and calls visit(msg) once per key; on equal keys the
+// earlier run wins, so the runs must be listed in input order
+template <typename Visitor>
+void mergeSpillRuns(const std::vector<std::string>& paths, Visitor visit) {
+    std::vector<std::unique_ptr<SpillReader>> readers;
+    for (const auto& path : paths) {
+        readers.push_back(std::make_unique<SpillReader>(path));
+    }
+    auto after = [&readers](size_t a, size_t b) {
+        const MessageRef& x = readers[a]->current();
+        const MessageRef& y = readers[b]->current();
+        if (x.time != y.time) {
+            return x.time > y.time;
+        }
+        if (x.user != y.user) {
+            return x.user > y.user;
+        }
+        return a > b;
+    };
+    std::priority_queue<size_t, std::vector<size_t>, decltype(after)> heads(after);
+    for (size_t i = 0; i < readers.size(); ++i) {
+        if (readers[i]->next()) {
+            heads.push(i);
+        }
+    }
+    bool emitted = false;
+    int64_t lastTime = 0;
+    std::string lastUser;
+    while (!heads.empty()) {
+        size_t index = heads.top();
+        heads.pop();
+        const MessageRef& msg = readers[index]->current();
+        if (!emitted || msg.time != lastTime || msg.user != lastUser) {
+            visit(msg);
+            emitted = true;
+            lastTime = msg.time;
+            lastUser.assign(msg.user.data(), msg.user.size());
+        }
+        if (readers[index]->next()) {
+            heads.push(index);
+        }
+    }
+}
+
+// Loads message files larger than memory into the store's segments. The files are parsed in order
+// into batches of about memoryBudget bytes, each sorted and spilled as a run under
+// <segment directory>/spill; more than MERGE_FAN_IN runs are first merged in groups. The final
+// merge streams the deduplicated messages into day segments through addSegment, cutting a day
+// into several segments when it exceeds the budget. On equal keys the earlier file wins, as in
+// loadMessagesFromFiles. Returns the number of messages stored.
+size_t mergeMessageFilesToStore(const std::vector<std::string>& filenames, MessageStore& store,
+    const std::string& directory, size_t memoryBudget) {
+    constexpr size_t MERGE_FAN_IN = 64;
+    std::filesystem::path spillDirectory = std::filesystem::path(directory) / "spill";
+    std::filesystem::create_directories(spillDirectory);
+    size_t nextRun = 0;
+    auto runPath = [&]() { return (spillDirectory / ("run-" + std::to_string(nextRun++) + ".tmp")).string(); };
+
+    std::vector<std::string> runs;
+    std::vector<ParsedMessage> batch;
+    std::vector<std::unique_ptr<MappedFile>> batchFiles;
+    size_t batchBytes = 0;
+    auto spill = [&]() {
+        if (batch.empty()) {
+            return;
+        }
+        std::stable_sort(batch.begin(), batch.end(), [](const ParsedMessage& a, const ParsedMessage& b) {
+            return a.time != b.time ? a.time < b.time : a.user < b.user;
+            });
+        runs.push_back(runPath());
+        SpillWriter writer(runs.back());
+        for (const auto& msg : batch) {
+            writer.write(msg.time, msg.user, msg.text);
+        }
+        writer.close();
+        batch.clear();
+        // The mapping being parsed is still needed for the rest of its file
+        if (batchFiles.size() > 1) {
+            batchFiles.erase(batchFiles.begin(), batchFiles.end() - 1);
+        }
+        batchBytes = 0;
+    };
+    for (const auto& filename : filenames) {
+        try {
+            batchFiles.push_back(std::make_unique<MappedFile>(filename));
+        }
+        catch (const std::runtime_error& error) {
+            std::cerr << error.what() << std::endl;
+            continue;
+        }
+        forEachLine(batchFiles.back()->view(), [&](std::string_view line, size_t lineNumber) {
+            ParsedMessage msg;
+            std::string_view time;
+            if (!parseMessageLine(line, msg.user, time, msg.text)) {
+                std::cerr << filename << ":" << lineNumber << ": Invalid message format\n";
+            }
+            else if (!parseTimestamp(time, msg.time)) {
+                std::cerr << filename << ":" << lineNumber << ": Invalid message time: " << time << "\n";
+            }
+            else {
+                batch.push_back(msg);
+                batchBytes += sizeof(ParsedMessage) + msg.user.size() + msg.text.size();
+                if (batchBytes >= memoryBudget) {
+                    spill();
+                }
+            }
+            });
+    }
+    spill();
+    batchFiles.clear();
+    batch = {};
+
+    while (runs.size() > MERGE_FAN_IN) {
+        std::vector<std::string> merged;
+        for (size_t first = 0; first < runs.size(); first += MERGE_FAN_IN) {
+            std::vector<std::string> group(runs.begin() + static_cast<std::ptrdiff_t>(first),
+                runs.begin() + static_cast<std::ptrdiff_t>(std::min(first + MERGE_FAN_IN, runs.size())));
+            merged.push_back(runPath());
+            SpillWriter writer(merged.back());
+            mergeSpillRuns(group, [&](const MessageRef& msg) { writer.write(msg.time, msg.user, msg.text); });
+            writer.close();
+            for (const auto& path : group) {
+                std::filesystem::remove(path);
+            }
+        }
+        runs = std::move(merged);
+    }
+
+    auto dayOf = [](int64_t time) { return (time >= 0 ? time : time - 86399999) / 86400000; };
+    size_t stored = 0;
+    std::vector<MessageRef> day;
+    std::deque<std::string> owned;
+    size_t dayBytes = 0;
+    auto writeDay = [&]() {
+        if (!day.empty()) {
+            stored += store.addSegment(day);
+        }
+        day.clear();
+        owned.clear();
+        dayBytes = 0;
+    };
+    mergeSpillRuns(runs, [&](const MessageRef& msg) {
+        if (!day.empty() && (dayOf(day.front().time) != dayOf(msg.time) || dayBytes >= memoryBudget)) {
+            writeDay();
+        }
+        owned.emplace_back(msg.user);
+        std::string_view user = owned.back();
+        owned.emplace_back(msg.text);
+        day.push_back(MessageRef{ msg.time, user, owned.back() });
+        dayBytes += sizeof(MessageRef) + msg.user.size() + msg.text.size();
+        });
+    writeDay();
+    std::filesystem::remove_all(spillDirectory);
+    return stored;
+}
+
+// Compares lines per second of the former std::regex parser and the scanner on the given files
+int benchmarkParser(const std::vector<std::string>& filenames) {
+    std::vector<std::unique_ptr<MappedFile>> files;
+    try {
+        for (const auto& filename : filenames) {
+            files.push_back(std::make_unique<MappedFile>(filename));
+        }
+    }
+    catch (const std::runtime_error& error) {
+        std::cerr << error.what() << std::endl;
+        return 1;
+    }
+
+    auto measure = [&](const char* name, auto parseLine) {
+        size_t lines = 0;
+        size_t parsed = 0;
+        auto start = std::chrono::steady_clock::now();
+        for (const auto& file : files) {
+            forEachLine(file->view(), [&](std::string_view line, size_t) {
+                ++lines;
+                parsed += parseLine(line) ? 1 : 0;
+                });
+        }
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        std::cout << name << ": " << lines << " lines, " << parsed << " parsed, " << std::fixed << std::setprecision(3)
+            << seconds << " s, " << std::setprecision(0) << (seconds > 0 ? lines / seconds : 0.0) << " lines/s\n";
+    };
+
     std::regex messageRegex(R"((\S+)\s+(\S+):\s+(.+))");
-    std::smatch match;
+    measure("regex  ", [&](std::string_view view) {
+        std::string line(view);
+        std::smatch match;
+        int64_t timestamp;
+        return std::regex_match(line, match, messageRegex) && parseTimestamp(match[2].str(), timestamp);
+        });
+    measure("scanner", [](std::string_view line) {
+        std::string_view user, time, text;
+        int64_t timestamp;
+        return parseMessageLine(line, user, time, text) && parseTimestamp(time, timestamp);
+        });
+    std::cout.flush();
+    return 0;
+}
 
-    while (std::getline(file, line)) {
-        if (std::regex_match(line, match, messageRegex)) {
-            store.addMessage(match[1], match[2], match[3]);
+// Synthetic chat log of --bench. Arrivals are a Poisson process with the given rate, the i-th
+// user is picked with weight 1/(i+1), and text lengths are exponential with the given mean. Texts
+// are words of a random vocabulary, again with weights 1/(i+1), so the text index sees a
+// realistic number of distinct tokens.
+struct BenchmarkOptions {
+    size_t messages = 1000000;
+    size_t users = 1000;
+    double rate = 50;
+    double textMean = 60;
+    size_t queries = 1000;
+    uint32_t seed = 1;
+};
+
+// Writes the log to filename and returns a sample of up to options.queries of its
+// (user, time) keys for the delete measurements
+std::vector<std::pair<std::string, std::string>> generateChatLog(const std::string& filename, const BenchmarkOptions& options) {
+    std::ofstream output(filename, std::ios::binary | std::ios::trunc);
+    if (!output) {
+        throw std::runtime_error("Error opening file: " + filename);
+    }
+    auto harmonic = [](size_t count) {
+        std::vector<double> weights(std::max<size_t>(count, 1));
+        for (size_t i = 0; i < weights.size(); ++i) {
+            weights[i] = 1.0 / static_cast<double>(i + 1);
         }
-        else {
-            std::cerr << "Invalid message format in file: " << filename << std::endl;
+        return std::discrete_distribution<size_t>(weights.begin(), weights.end());
+    };
+    std::mt19937_64 random(options.seed);
+    std::discrete_distribution<size_t> pickUser = harmonic(options.users);
+    std::exponential_distribution<double> gap(options.rate / 1000.0);
+    std::exponential_distribution<double> textLength(1.0 / std::max(options.textMean, 1.0));
+    std::uniform_int_distribution<int> letter('a', 'z');
+    std::uniform_int_distribution<size_t> wordLength(2, 9);
+    std::vector<std::string> vocabulary(5000);
+    for (auto& word : vocabulary) {
+        for (size_t length = wordLength(random); word.size() < length;) {
+            word += static_cast<char>(letter(random));
+        }
+    }
+    std::discrete_distribution<size_t> pickWord = harmonic(vocabulary.size());
+
+    std::vector<std::pair<std::string, std::string>> sample;
+    double time = static_cast<double>(daysFromCivil(2024, 1, 1)) * 86400000.0;
+    std::string block;
+    std::string line;
+    for (size_t i = 0; i < options.messages; ++i) {
+        time += gap(random);
+        line = "user" + std::to_string(pickUser(random)) + " ";
+        std::string user = line.substr(0, line.size() - 1);
+        std::string stamp = formatTimestamp(static_cast<int64_t>(time));
+        line += stamp;
+        line += ": ";
+        size_t end = line.size() + 1 + static_cast<size_t>(textLength(random));
+        line += vocabulary[pickWord(random)];
+        while (line.size() < end) {
+            line += ' ';
+            line += vocabulary[pickWord(random)];
+        }
+        line += '\n';
+        block += line;
+        if (block.size() >= (1 << 20)) {
+            output.write(block.data(), static_cast<std::streamsize>(block.size()));
+            block.clear();
+        }
+        // Reservoir sampling keeps every key equally likely
+        if (sample.size() < options.queries) {
+            sample.emplace_back(user, stamp);
+        }
+        else if (options.queries > 0) {
+            size_t slot = std::uniform_int_distribution<size_t>(0, i)(random);
+            if (slot < options.queries) {
+                sample[slot] = { user, stamp };
+            }
+        }
+    }
+    output.write(block.data(), static_cast<std::streamsize>(block.size()));
+    if (!output) {
+        throw std::runtime_error("Error writing file: " + filename);
+    }
+    return sample;
+}
+
+// Measures load throughput, memory per message and the latency of the store operations on a
+// generated log. Query results are counted, not printed; the delete messages are discarded.
+int runBenchmark(const BenchmarkOptions& options) {
+    using Clock = std::chrono::steady_clock;
+    std::string filename = (std::filesystem::temp_directory_path() / "num12-bench.txt").string();
+    std::vector<std::pair<std::string, std::string>> keys;
+    try {
+        keys = generateChatLog(filename, options);
+    }
+    catch (const std::exception& error) {
+        std::cerr << error.what() << std::endl;
+        return 1;
+    }
+    size_t fileBytes = std::filesystem::file_size(filename);
+
+    MessageStore store;
+    auto loadStart = Clock::now();
+    loadMessagesFromFiles({ filename }, store);
+    double loadSeconds = std::chrono::duration<double>(Clock::now() - loadStart).count();
+    std::filesystem::remove(filename);
+    size_t loaded = store.size();
+    if (loaded == 0) {
+        std::cerr << "No messages generated." << std::endl;
+        return 1;
+    }
+
+    std::cout << std::fixed << std::setprecision(1);
+    std::cout << "messages: " << loaded << " (" << options.users << " users, " << options.rate << " msg/s, mean text "
+        << options.textMean << " bytes)\n";
+    std::cout << "load: " << std::setprecision(3) << loadSeconds << " s, " << std::setprecision(0)
+        << (loadSeconds > 0 ? loaded / loadSeconds : 0.0) << " msg/s, " << std::setprecision(1)
+        << (loadSeconds > 0 ? fileBytes / loadSeconds / (1 << 20) : 0.0) << " MiB/s\n";
+    size_t memory = store.memoryUsage();
+    std::cout << "memory: " << memory / (1 << 20) << " MiB, " << static_cast<double>(memory) / loaded << " bytes/msg ("
+        << static_cast<double>(fileBytes) / loaded << " bytes/msg in the file)\n";
+
+    std::mt19937_64 random(options.seed + 1);
+    int64_t startTime = std::numeric_limits<int64_t>::max();
+    int64_t endTime = std::numeric_limits<int64_t>::min();
+    for (const auto& key : keys) {
+        int64_t time;
+        parseTimestamp(key.second, time);
+        startTime = std::min(startTime, time);
+        endTime = std::max(endTime, time);
+    }
+    // Range queries cover about a hundred messages
+    int64_t window = static_cast<int64_t>(100.0 / options.rate * 1000.0);
+
+    auto report = [](const char* name, std::vector<double>& latencies, size_t results) {
+        if (latencies.empty()) {
+            return;
         }
+        std::sort(latencies.begin(), latencies.end());
+        auto percentile = [&](double p) { return latencies[static_cast<size_t>(p * (latencies.size() - 1))]; };
+        std::cout << name << ": n=" << latencies.size() << ", p50 " << std::setprecision(1) << percentile(0.5) << " us, p90 "
+            << percentile(0.9) << " us, p99 " << percentile(0.99) << " us, max " << latencies.back() << " us, "
+            << results << " results\n";
+    };
+    auto timed = [](auto operation) {
+        auto start = Clock::now();
+        operation();
+        return std::chrono::duration<double, std::micro>(Clock::now() - start).count();
+    };
+
+    std::vector<double> latencies;
+    size_t results = 0;
+    for (size_t i = 0; i < options.queries; ++i) {
+        std::string user = "user" + std::to_string(std::uniform_int_distribution<size_t>(0, options.users - 1)(random));
+        latencies.push_back(timed([&]() {
+            for (const MessageRef& msg : store.messagesByUser(user)) {
+                results += msg.text.size() > 0;
+            }
+            }));
+    }
+    report("by-user", latencies, results);
+
+    latencies.clear();
+    results = 0;
+    for (size_t i = 0; i < options.queries; ++i) {
+        int64_t start = std::uniform_int_distribution<int64_t>(startTime, endTime)(random);
+        latencies.push_back(timed([&]() {
+            for (const MessageRef& msg : store.messagesInRange(start, start + window)) {
+                results += msg.text.size() > 0;
+            }
+            }));
+    }
+    report("by-range", latencies, results);
+
+    // The store reports each deletion on std::cout
+    std::ostringstream discarded;
+    std::streambuf* console = std::cout.rdbuf(discarded.rdbuf());
+    latencies.clear();
+    for (const auto& key : keys) {
+        latencies.push_back(timed([&]() { store.deleteMessage(key.first, key.second); }));
+        discarded.str("");
+    }
+    size_t afterDeletes = store.size();
+    std::vector<double> userLatencies;
+    for (size_t i = 0; i < std::min(options.queries, options.users); ++i) {
+        std::string user = "user" + std::to_string(i);
+        userLatencies.push_back(timed([&]() { store.deleteMessagesByUser(user); }));
+        discarded.str("");
     }
+    std::cout.rdbuf(console);
+    report("delete", latencies, loaded - afterDeletes);
+    report("delete-by-user", userLatencies, afterDeletes - store.size());
+    std::cout.flush();
+    return 0;
 }
 
 int main(int argc, char* argv[]) {
     if (argc < 2) {
-        std::cerr << "Usage: " << argv[0] << " <file1> <file2> ..." << std::endl;
+        std::cerr << "Usage: " << argv[0] << " [--store <directory>] <file1> <file2> ..." << std::endl;
+        std::cerr << "       " << argv[0] << " --export <text|jsonl|csv> <output> <file1> <file2> ..." << std::endl;
+        std::cerr << "       " << argv[0] << " --external-merge <directory> <memory MiB> <file1> <file2> ..." << std::endl;
+        std::cerr << "       " << argv[0] << " --bench-parser <file1> <file2> ..." << std::endl;
+        std::cerr << "       " << argv[0] << " --bench [--messages N] [--users N] [--rate msg/s] [--text-mean bytes] [--queries N] [--seed N]" << std::endl;
         return 1;
     }
+    if (std::string(argv[1]) == "--bench-parser") {
+        return benchmarkParser(std::vector<std::string>(argv + 2, argv + argc));
+    }
+    if (std::string(argv[1]) == "--bench") {
+        BenchmarkOptions options;
+        for (int i = 2; i + 1 < argc; i += 2) {
+            std::string option = argv[i];
+            double value = std::strtod(argv[i + 1], nullptr);
+            if (option == "--messages") {
+                options.messages = static_cast<size_t>(value);
+            }
+            else if (option == "--users") {
+                options.users = std::max<size_t>(static_cast<size_t>(value), 1);
+            }
+            else if (option == "--rate") {
+                options.rate = value > 0 ? value : options.rate;
+            }
+            else if (option == "--text-mean") {
+                options.textMean = value;
+            }
+            else if (option == "--queries") {
+                options.queries = static_cast<size_t>(value);
+            }
+            else if (option == "--seed") {
+                options.seed = static_cast<uint32_t>(value);
+            }
+            else {
+                std::cerr << "Unknown option: " << option << std::endl;
+                return 1;
+            }
+        }
+        return runBenchmark(options);
+    }
+    if (std::string(argv[1]) == "--export") {
+        OutputFormat format;
+        if (argc < 4 || !parseOutputFormat(argv[2], format)) {
+            std::cerr << "Usage: " << argv[0] << " --export <text|jsonl|csv> <output> <file1> <file2> ..." << std::endl;
+            return 1;
+        }
+        MessageStore store;
+        loadMessagesFromFiles(std::vector<std::string>(argv + 4, argv + argc), store);
+        std::ofstream output(argv[3], std::ios::binary);
+        if (!output) {
+            std::cerr << "Error opening file: " << argv[3] << std::endl;
+            return 1;
+        }
+        MessageWriter writer(output, format);
+        size_t written = writer.writeAll(store.messages());
+        writer.flush();
+        std::cout << written << " messages exported to " << argv[3] << "." << std::endl;
+        return output ? 0 : 1;
+    }
+    if (std::string(argv[1]) == "--external-merge") {
+        size_t budget = argc >= 4 ? std::strtoull(argv[3], nullptr, 10) : 0;
+        if (budget == 0) {
+            std::cerr << "Usage: " << argv[0] << " --external-merge <directory> <memory MiB> <file1> <file2> ..." << std::endl;
+            return 1;
+        }
+        try {
+            MessageStore store;
+            store.openSegments(argv[2]);
+            size_t stored = mergeMessageFilesToStore(std::vector<std::string>(argv + 4, argv + argc), store, argv[2], budget << 20);
+            std::cout << stored << " messages merged into " << argv[2] << "." << std::endl;
+        }
+        catch (const std::exception& error) {
+            std::cerr << error.what() << std::endl;
+            return 1;
+        }
+        return 0;
+    }
     system("color F0");
     MessageStore store;
 
-    for (int i = 1; i < argc; ++i) {
-        loadMessagesFromFile(argv[i], store);
+    // With --store the directory's segments are mapped, and the given files are added to them
+    int firstFile = 1;
+    bool persistent = argc >= 3 && std::string(argv[1]) == "--store";
+    if (persistent) {
+        try {
+            store.openSegments(argv[2]);
+        }
+        catch (const std::exception& error) {
+            std::cerr << error.what() << std::endl;
+            return 1;
+        }
+        firstFile = 3;
+    }
+
+    loadMessagesFromFiles(std::vector<std::string>(argv + firstFile, argv + argc), store);
+    if (persistent) {
+        try {
+            store.flushSegments();
+        }
+        catch (const std::exception& error) {
+            std::cerr << error.what() << std::endl;
+        }
     }
 
     std::cout << "Loaded messages:" << std::endl;
@@ -143,6 +3146,15 @@ int main(int argc, char* argv[]) {
     std::cout << "\nMessages in range " << startTime << " to " << endTime << ":" << std::endl;
     store.printMessagesInRange(startTime, endTime);
 
+    std::string query = "you";
+    std::cout << "\nMessages containing \"" << query << "\":" << std::endl;
+    store.printSearch(query, true);
+
+    std::cout << "\nMost active users:" << std::endl;
+    for (const auto& entry : store.topUsers(std::numeric_limits<int64_t>::min(), std::numeric_limits<int64_t>::max(), 3)) {
+        std::cout << entry.user << ": " << entry.count << std::endl;
+    }
+
     std::cout << std::endl;
     store.deleteMessage(user, time);
     std::cout << "Messages after deletion attempt:" << std::endl;
@@ -6,174 +6,1995 @@
 #include <fstream>
 #include <vector>
 #include <unordered_map>
-#include <stack>
 #include <functional>
 #include <limits>
+#include <algorithm>
+#include <thread>
+#include <future>
+#include <mutex>
+#include <condition_variable>
+#include <queue>
+#include <deque>
+#include <memory>
+#include <string_view>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <optional>
+#include <cctype>
+#include <bit>
+#include <array>
+#include <chrono>
+#include <random>
+#include <cmath>
+#include <iomanip>
+#include <atomic>
+#include <type_traits>
 
+//  AVX2    x64-,       cpuid,
+//      AVX2  
+#if defined(_M_X64) || defined(__x86_64__)
+#include <immintrin.h>
+#define TEXT_SCANNER_AVX2
+#ifdef _MSC_VER
+#include <intrin.h>
+#define TEXT_SCANNER_AVX2_TARGET
+#else
+#define TEXT_SCANNER_AVX2_TARGET __attribute__((target("avx2")))
+#endif
+#endif
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define TEXT_SCANNER_SSE2
+#endif
+
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#endif
+
+//       
+class MappedFile {
+private:
+    const char* data = nullptr;
+    size_t length = 0;
+#ifdef _WIN32
+    HANDLE file = INVALID_HANDLE_VALUE;
+    HANDLE mapping = nullptr;
+#endif
+
+    void release() {
+#ifdef _WIN32
+        if (data != nullptr) {
+            UnmapViewOfFile(data);
+        }
+        if (mapping != nullptr) {
+            CloseHandle(mapping);
+        }
+        if (file != INVALID_HANDLE_VALUE) {
+            CloseHandle(file);
+        }
+        mapping = nullptr;
+        file = INVALID_HANDLE_VALUE;
+#else
+        if (data != nullptr) {
+            munmap(const_cast<char*>(data), length);
+        }
+#endif
+        data = nullptr;
+        length = 0;
+    }
+
+public:
+    explicit MappedFile(const std::string& filename) {
+#ifdef _WIN32
+        file = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_DELETE, nullptr,
+            OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+        if (file == INVALID_HANDLE_VALUE) {
+            throw std::runtime_error("Could not open file: " + filename);
+        }
+        LARGE_INTEGER size;
+        if (!GetFileSizeEx(file, &size)) {
+            release();
+            throw std::runtime_error("Could not read size of file: " + filename);
+        }
+        length = static_cast<size_t>(size.QuadPart);
+        if (length == 0) {
+            return;
+        }
+        mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        if (mapping != nullptr) {
+            data = static_cast<const char*>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+        }
+        if (data == nullptr) {
+            release();
+            throw std::runtime_error("Could not map file: " + filename);
+        }
+#else
+        int descriptor = open(filename.c_str(), O_RDONLY);
+        if (descriptor < 0) {
+            throw std::runtime_error("Could not open file: " + filename);
+        }
+        struct stat info;
+        if (fstat(descriptor, &info) != 0) {
+            close(descriptor);
+            throw std::runtime_error("Could not read size of file: " + filename);
+        }
+        length = static_cast<size_t>(info.st_size);
+        if (length > 0) {
+            void* mapped = mmap(nullptr, length, PROT_READ, MAP_PRIVATE, descriptor, 0);
+            if (mapped == MAP_FAILED) {
+                close(descriptor);
+                length = 0;
+                throw std::runtime_error("Could not map file: " + filename);
+            }
+            madvise(mapped, length, MADV_SEQUENTIAL);
+            data = static_cast<const char*>(mapped);
+        }
+        close(descriptor);
+#endif
+    }
+
+    ~MappedFile() {
+        release();
+    }
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    std::string_view view() const {
+        return std::string_view(data, length);
+    }
+};
+
+//  :     std::string_view   std::string
+struct StringHash {
+    using is_transparent = void;
+
+    size_t operator()(std::string_view value) const {
+        return std::hash<std::string_view>{}(value);
+    }
+};
+
+using DictionaryEntries = std::vector<std::pair<std::string, std::vector<std::string>>>;
+
+//   :  ,   -
+// (hash and displace)    .     ,
+//    .    little-endian .
+class CompiledDictionary {
+private:
+    static constexpr char MAGIC[8] = { 'S', 'Y', 'N', 'D', 'I', 'C', 'T', '1' };
+    static constexpr uint32_t DIRECT_SLOT = 0x80000000u;
+
+    struct Header {
+        char magic[8];
+        uint64_t salt;
+        uint64_t pool_size;
+        uint32_t synonym_count;
+        uint32_t canonical_count;
+        uint32_t bucket_count;
+        uint32_t reserved;
+    };
+
+    struct SlotRecord {
+        uint32_t offset;
+        uint32_t length;
+        uint32_t canonical;
+    };
+
+    struct CanonicalRecord {
+        uint32_t offset;
+        uint32_t length;
+        uint32_t first_member;
+        uint32_t member_count;
+    };
+
+    MappedFile file;
+    const Header* header = nullptr;
+    const uint32_t* buckets = nullptr;
+    const SlotRecord* slots = nullptr;
+    const CanonicalRecord* canonicals = nullptr;
+    const uint32_t* members = nullptr;
+    const char* pool = nullptr;
+
+    static uint64_t mix(uint64_t h) {
+        h ^= h >> 33;
+        h *= 0xff51afd7ed558ccdULL;
+        h ^= h >> 33;
+        h *= 0xc4ceb9fe1a85ec53ULL;
+        h ^= h >> 33;
+        return h;
+    }
+
+    static uint64_t hashKey(std::string_view key, uint64_t salt) {
+        uint64_t h = 1469598103934665603ULL ^ salt;
+        for (unsigned char c : key) {
+            h ^= c;
+            h *= 1099511628211ULL;
+        }
+        return mix(h);
+    }
+
+    static uint32_t bucketOf(uint64_t hash, uint32_t bucket_count) {
+        return static_cast<uint32_t>((hash >> 32) % bucket_count);
+    }
+
+    static uint32_t slotOf(uint64_t hash, uint32_t seed, uint32_t slot_count) {
+        if (seed & DIRECT_SLOT) {
+            return seed & ~DIRECT_SLOT;
+        }
+        return static_cast<uint32_t>(mix(hash ^ (seed * 0x9E3779B97F4A7C15ULL)) % slot_count);
+    }
+
+    std::string_view poolString(uint32_t offset, uint32_t length) const {
+        return std::string_view(pool + offset, length);
+    }
+
+    //      ,       
+    static bool buildPerfectHash(const std::vector<std::string_view>& keys, uint64_t salt,
+        uint32_t bucket_count, std::vector<uint32_t>& seeds, std::vector<uint32_t>& slot_of_key) {
+        const uint32_t n = static_cast<uint32_t>(keys.size());
+        std::vector<uint64_t> hashes(n);
+        std::vector<std::vector<uint32_t>> bucket_keys(bucket_count);
+        for (uint32_t i = 0; i < n; ++i) {
+            hashes[i] = hashKey(keys[i], salt);
+            bucket_keys[bucketOf(hashes[i], bucket_count)].push_back(i);
+        }
+
+        std::vector<uint32_t> order(bucket_count);
+        for (uint32_t b = 0; b < bucket_count; ++b) {
+            order[b] = b;
+        }
+        std::stable_sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) {
+            return bucket_keys[a].size() > bucket_keys[b].size();
+        });
+
+        seeds.assign(bucket_count, 0);
+        slot_of_key.assign(n, 0);
+        std::vector<bool> taken(n, false);
+        std::vector<uint32_t> candidate;
+        uint32_t next_free = 0;
+
+        for (uint32_t b : order) {
+            const auto& bucket = bucket_keys[b];
+            if (bucket.empty()) {
+                break;
+            }
+            if (bucket.size() == 1) {
+                while (taken[next_free]) {
+                    ++next_free;
+                }
+                taken[next_free] = true;
+                seeds[b] = DIRECT_SLOT | next_free;
+                slot_of_key[bucket[0]] = next_free;
+                continue;
+            }
+
+            bool placed = false;
+            for (uint32_t seed = 1; seed < (1u << 16) && !placed; ++seed) {
+                candidate.clear();
+                placed = true;
+                for (uint32_t key : bucket) {
+                    uint32_t slot = slotOf(hashes[key], seed, n);
+                    if (taken[slot] || std::find(candidate.begin(), candidate.end(), slot) != candidate.end()) {
+                        placed = false;
+                        break;
+                    }
+                    candidate.push_back(slot);
+                }
+                if (placed) {
+                    for (size_t i = 0; i < bucket.size(); ++i) {
+                        taken[candidate[i]] = true;
+                        slot_of_key[bucket[i]] = candidate[i];
+                    }
+                    seeds[b] = seed;
+                }
+            }
+            if (!placed) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    template <typename T>
+    static void writeArray(std::ofstream& out, const std::vector<T>& values) {
+        if (!values.empty()) {
+            out.write(reinterpret_cast<const char*>(values.data()), static_cast<std::streamsize>(values.size() * sizeof(T)));
+        }
+    }
+
+public:
+    explicit CompiledDictionary(const std::string& filename) : file(filename) {
+        std::string_view bytes = file.view();
+        if (bytes.size() < sizeof(Header) || std::memcmp(bytes.data(), MAGIC, sizeof(MAGIC)) != 0) {
+            throw std::runtime_error("Not a compiled dictionary: " + filename);
+        }
+        header = reinterpret_cast<const Header*>(bytes.data());
+
+        uint64_t expected = sizeof(Header)
+            + uint64_t(header->bucket_count) * sizeof(uint32_t)
+            + uint64_t(header->synonym_count) * sizeof(SlotRecord)
+            + uint64_t(header->canonical_count) * sizeof(CanonicalRecord)
+            + uint64_t(header->synonym_count) * sizeof(uint32_t)
+            + header->pool_size;
+        if (expected != bytes.size() || (header->synonym_count > 0 && header->bucket_count == 0)) {
+            throw std::runtime_error("Corrupted compiled dictionary: " + filename);
+        }
+
+        const char* cursor = bytes.data() + sizeof(Header);
+        buckets = reinterpret_cast<const uint32_t*>(cursor);
+        cursor += header->bucket_count * sizeof(uint32_t);
+        slots = reinterpret_cast<const SlotRecord*>(cursor);
+        cursor += header->synonym_count * sizeof(SlotRecord);
+        canonicals = reinterpret_cast<const CanonicalRecord*>(cursor);
+        cursor += header->canonical_count * sizeof(CanonicalRecord);
+        members = reinterpret_cast<const uint32_t*>(cursor);
+        cursor += header->synonym_count * sizeof(uint32_t);
+        pool = cursor;
+    }
+
+    static bool isCompiled(const std::string& filename) {
+        std::ifstream in(filename, std::ios::binary);
+        char magic[sizeof(MAGIC)] = {};
+        return in.read(magic, sizeof(magic)) && std::memcmp(magic, MAGIC, sizeof(MAGIC)) == 0;
+    }
+
+    bool find(std::string_view word, std::string_view& canonical) const {
+        if (header->synonym_count == 0) {
+            return false;
+        }
+        uint64_t hash = hashKey(word, header->salt);
+        uint32_t seed = buckets[bucketOf(hash, header->bucket_count)];
+        const SlotRecord& slot = slots[slotOf(hash, seed, header->synonym_count)];
+        if (poolString(slot.offset, slot.length) != word) {
+            return false;
+        }
+        const CanonicalRecord& record = canonicals[slot.canonical];
+        canonical = poolString(record.offset, record.length);
+        return true;
+    }
+
+    //    ( , ),    
+    template <typename Visitor>
+    void forEachEntry(Visitor visit) const {
+        for (uint32_t c = 0; c < header->canonical_count; ++c) {
+            const CanonicalRecord& record = canonicals[c];
+            std::string_view canonical = poolString(record.offset, record.length);
+            for (uint32_t m = 0; m < record.member_count; ++m) {
+                const SlotRecord& slot = slots[members[record.first_member + m]];
+                visit(canonical, poolString(slot.offset, slot.length));
+            }
+        }
+    }
+
+    // :     
+    static void compile(const std::string& filename, const DictionaryEntries& entries) {
+        std::vector<std::string_view> canonical_words;
+        std::unordered_map<std::string_view, uint32_t> canonical_ids;
+        std::vector<std::string_view> keys;
+        std::vector<uint32_t> key_canonical;
+        std::unordered_map<std::string_view, uint32_t> key_ids;
+
+        for (const auto& entry : entries) {
+            auto inserted = canonical_ids.emplace(entry.first, static_cast<uint32_t>(canonical_words.size()));
+            if (inserted.second) {
+                canonical_words.push_back(entry.first);
+            }
+            uint32_t canonical_id = inserted.first->second;
+            for (const auto& synonym : entry.second) {
+                auto key = key_ids.emplace(synonym, static_cast<uint32_t>(keys.size()));
+                if (key.second) {
+                    keys.push_back(synonym);
+                    key_canonical.push_back(canonical_id);
+                }
+                else {
+                    key_canonical[key.first->second] = canonical_id;
+                }
+            }
+        }
+        if (keys.size() >= DIRECT_SLOT || canonical_words.size() >= DIRECT_SLOT) {
+            throw std::runtime_error("Dictionary is too large to compile: " + filename);
+        }
+
+        Header header = {};
+        std::memcpy(header.magic, MAGIC, sizeof(MAGIC));
+        header.synonym_count = static_cast<uint32_t>(keys.size());
+        header.canonical_count = static_cast<uint32_t>(canonical_words.size());
+        header.bucket_count = header.synonym_count == 0 ? 0 : (header.synonym_count + 1) / 2;
+
+        std::vector<uint32_t> seeds;
+        std::vector<uint32_t> slot_of_key;
+        if (header.synonym_count > 0) {
+            while (!buildPerfectHash(keys, header.salt, header.bucket_count, seeds, slot_of_key)) {
+                ++header.salt;
+            }
+        }
+
+        std::string pool_bytes;
+        auto intern = [&](std::string_view value) {
+            if (pool_bytes.size() + value.size() > UINT32_MAX) {
+                throw std::runtime_error("Dictionary is too large to compile: " + filename);
+            }
+            uint32_t offset = static_cast<uint32_t>(pool_bytes.size());
+            pool_bytes.append(value);
+            return offset;
+        };
+
+        std::vector<SlotRecord> slot_records(keys.size());
+        for (size_t k = 0; k < keys.size(); ++k) {
+            SlotRecord& slot = slot_records[slot_of_key[k]];
+            slot.offset = intern(keys[k]);
+            slot.length = static_cast<uint32_t>(keys[k].size());
+            slot.canonical = key_canonical[k];
+        }
+
+        std::vector<std::vector<uint32_t>> grouped(canonical_words.size());
+        for (size_t k = 0; k < keys.size(); ++k) {
+            grouped[key_canonical[k]].push_back(slot_of_key[k]);
+        }
+        std::vector<CanonicalRecord> canonical_records(canonical_words.size());
+        std::vector<uint32_t> member_slots;
+        member_slots.reserve(keys.size());
+        for (size_t c = 0; c < canonical_words.size(); ++c) {
+            CanonicalRecord& record = canonical_records[c];
+            record.offset = intern(canonical_words[c]);
+            record.length = static_cast<uint32_t>(canonical_words[c].size());
+            record.first_member = static_cast<uint32_t>(member_slots.size());
+            record.member_count = static_cast<uint32_t>(grouped[c].size());
+            member_slots.insert(member_slots.end(), grouped[c].begin(), grouped[c].end());
+        }
+        header.pool_size = pool_bytes.size();
+
+        //      ,       .
+        //       :       
+        static std::atomic<uint64_t> compile_counter{ 0 };
+        std::string temp_filename = filename + "." + std::to_string(compile_counter.fetch_add(1)) + ".tmp";
+        try {
+            {
+                std::ofstream out(temp_filename, std::ios::binary | std::ios::trunc);
+                if (!out.is_open()) {
+                    throw std::runtime_error("Could not open file: " + temp_filename);
+                }
+                out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+                writeArray(out, seeds);
+                writeArray(out, slot_records);
+                writeArray(out, canonical_records);
+                writeArray(out, member_slots);
+                out.write(pool_bytes.data(), static_cast<std::streamsize>(pool_bytes.size()));
+                if (!out) {
+                    throw std::runtime_error("Could not write file: " + temp_filename);
+                }
+            }
+            std::filesystem::rename(temp_filename, filename);
+        }
+        catch (...) {
+            std::error_code ignored;
+            std::filesystem::remove(temp_filename, ignored);
+            throw;
+        }
+    }
+};
+
+//   :      16 (SSE2)  32 (AVX2) ,
+//       .  
+//        
+class TextScanner {
+private:
+    using FindClass = size_t(*)(std::string_view text, size_t pos, bool want_space);
+
+#ifdef TEXT_SCANNER_SSE2
+    //   : ' '   '\t'..'\r'
+    static uint32_t spaceMask(__m128i bytes) {
+        __m128i blank = _mm_cmpeq_epi8(bytes, _mm_set1_epi8(' '));
+        __m128i shifted = _mm_sub_epi8(bytes, _mm_set1_epi8('\t'));
+        __m128i control = _mm_cmpeq_epi8(_mm_min_epu8(shifted, _mm_set1_epi8(4)), shifted);
+        return static_cast<uint32_t>(_mm_movemask_epi8(_mm_or_si128(blank, control)));
+    }
+#endif
+#ifdef TEXT_SCANNER_AVX2
+    TEXT_SCANNER_AVX2_TARGET static uint32_t spaceMask(__m256i bytes) {
+        __m256i blank = _mm256_cmpeq_epi8(bytes, _mm256_set1_epi8(' '));
+        __m256i shifted = _mm256_sub_epi8(bytes, _mm256_set1_epi8('\t'));
+        __m256i control = _mm256_cmpeq_epi8(_mm256_min_epu8(shifted, _mm256_set1_epi8(4)), shifted);
+        return static_cast<uint32_t>(_mm256_movemask_epi8(_mm256_or_si256(blank, control)));
+    }
+
+    // AVX2         
+    static bool cpuHasAvx2() {
+#ifdef _MSC_VER
+        int info[4];
+        __cpuid(info, 0);
+        if (info[0] < 7) {
+            return false;
+        }
+        __cpuid(info, 1);
+        const int osxsave_and_avx = (1 << 27) | (1 << 28);
+        if ((info[2] & osxsave_and_avx) != osxsave_and_avx || (_xgetbv(0) & 6) != 6) {
+            return false;
+        }
+        __cpuidex(info, 7, 0);
+        return (info[1] & (1 << 5)) != 0;
+#else
+        return __builtin_cpu_supports("avx2");
+#endif
+    }
+
+    TEXT_SCANNER_AVX2_TARGET static size_t findClassAvx2(std::string_view text, size_t pos, bool want_space) {
+        const char* data = text.data();
+        const size_t size = text.size();
+        while (pos + 32 <= size) {
+            uint32_t mask = spaceMask(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + pos)));
+            if (!want_space) {
+                mask = ~mask;
+            }
+            if (mask != 0) {
+                return pos + std::countr_zero(mask);
+            }
+            pos += 32;
+        }
+        return findClassSse2(text, pos, want_space);
+    }
+#endif
+
+    //  ,   pos,   isSpace(c) == want_space
+    static size_t findClassSse2(std::string_view text, size_t pos, bool want_space) {
+        const char* data = text.data();
+        const size_t size = text.size();
+#ifdef TEXT_SCANNER_SSE2
+        while (pos + 16 <= size) {
+            uint32_t mask = spaceMask(_mm_loadu_si128(reinterpret_cast<const __m128i*>(data + pos)));
+            if (!want_space) {
+                mask = ~mask & 0xFFFFu;
+            }
+            if (mask != 0) {
+                return pos + std::countr_zero(mask);
+            }
+            pos += 16;
+        }
+#endif
+        while (pos < size && isSpace(data[pos]) != want_space) {
+            ++pos;
+        }
+        return pos;
+    }
+
+    static FindClass selectFindClass() {
+#ifdef TEXT_SCANNER_AVX2
+        if (cpuHasAvx2()) {
+            return findClassAvx2;
+        }
+#endif
+        return findClassSse2;
+    }
+
+    static size_t findClass(std::string_view text, size_t pos, bool want_space) {
+        static const FindClass selected = selectFindClass();
+        return selected(text, pos, want_space);
+    }
+
+public:
+    static bool isSpace(char c) {
+        return c == ' ' || static_cast<unsigned>(static_cast<unsigned char>(c)) - '\t' <= 4u;
+    }
+
+    //    ,   
+    template <typename Visitor>
+    static size_t forEachWord(std::string_view text, Visitor visit) {
+        size_t count = 0;
+        size_t pos = findClass(text, 0, false);
+        while (pos < text.size()) {
+            size_t end = findClass(text, pos + 1, true);
+            visit(text.substr(pos, end - pos));
+            ++count;
+            pos = findClass(text, end, false);
+        }
+        return count;
+    }
+
+    //  ASCII-   ;  false,     
+    static bool foldCase(std::string_view word, std::string& folded) {
+        folded.resize(word.size());
+        const char* source = word.data();
+        char* target = folded.data();
+        size_t pos = 0;
+        bool changed = false;
+#ifdef TEXT_SCANNER_SSE2
+        while (pos + 16 <= word.size()) {
+            __m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i*>(source + pos));
+            __m128i shifted = _mm_sub_epi8(bytes, _mm_set1_epi8('A'));
+            __m128i upper = _mm_cmpeq_epi8(_mm_min_epu8(shifted, _mm_set1_epi8(25)), shifted);
+            changed = changed || _mm_movemask_epi8(upper) != 0;
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(target + pos),
+                _mm_or_si128(bytes, _mm_and_si128(upper, _mm_set1_epi8(0x20))));
+            pos += 16;
+        }
+#endif
+        for (; pos < word.size(); ++pos) {
+            char c = source[pos];
+            if (c >= 'A' && c <= 'Z') {
+                c = static_cast<char>(c | 0x20);
+                changed = true;
+            }
+            target[pos] = c;
+        }
+        return changed;
+    }
+};
+
+//  -       .
+//   - ,    ,  
+//          .
+class PhraseMatcher {
+private:
+    static constexpr uint32_t NO_NODE = UINT32_MAX;
+    static constexpr uint32_t NO_PATTERN = UINT32_MAX;
+
+    struct Node {
+        uint32_t fail = 0;
+        uint32_t output = 0;
+        uint32_t depth = 0;
+        uint32_t pattern = NO_PATTERN;
+    };
+
+    std::vector<Node> nodes = std::vector<Node>(1);
+    std::unordered_map<uint64_t, uint32_t> edges;
+    std::unordered_map<std::string, uint32_t, StringHash, std::equal_to<>> vocabulary;
+    std::vector<std::string> canonicals;
+
+    static uint64_t edgeKey(uint32_t node, uint32_t word) {
+        return (uint64_t(node) << 32) | word;
+    }
+
+    uint32_t child(uint32_t node, uint32_t word) const {
+        auto it = edges.find(edgeKey(node, word));
+        return it != edges.end() ? it->second : NO_NODE;
+    }
+
+public:
+    static constexpr uint32_t ROOT = 0;
+    static constexpr uint32_t UNKNOWN_WORD = UINT32_MAX;
+
+    //     ;       
+    void addPhrase(std::string_view phrase, std::string_view canonical) {
+        if (TextScanner::forEachWord(phrase, [](std::string_view) {}) < 2) {
+            return;
+        }
+
+        uint32_t node = ROOT;
+        TextScanner::forEachWord(phrase, [&](std::string_view word) {
+            uint32_t id = vocabulary.emplace(std::string(word), static_cast<uint32_t>(vocabulary.size())).first->second;
+            uint32_t next = child(node, id);
+            if (next == NO_NODE) {
+                next = static_cast<uint32_t>(nodes.size());
+                Node created;
+                created.depth = nodes[node].depth + 1;
+                nodes.push_back(created);
+                edges.emplace(edgeKey(node, id), next);
+            }
+            node = next;
+            });
+
+        if (nodes[node].pattern == NO_PATTERN) {
+            nodes[node].pattern = static_cast<uint32_t>(canonicals.size());
+            canonicals.emplace_back(canonical);
+        }
+        else {
+            canonicals[nodes[node].pattern] = std::string(canonical);
+        }
+    }
+
+    //      
+    void build() {
+        std::vector<std::vector<std::pair<uint32_t, uint32_t>>> children(nodes.size());
+        for (const auto& edge : edges) {
+            children[static_cast<uint32_t>(edge.first >> 32)].emplace_back(static_cast<uint32_t>(edge.first), edge.second);
+        }
+
+        std::queue<uint32_t> queue;
+        queue.push(ROOT);
+        while (!queue.empty()) {
+            uint32_t node = queue.front();
+            queue.pop();
+            for (const auto& edge : children[node]) {
+                uint32_t word = edge.first;
+                uint32_t next = edge.second;
+                uint32_t fail = ROOT;
+                if (node != ROOT) {
+                    fail = nodes[node].fail;
+                    while (fail != ROOT && child(fail, word) == NO_NODE) {
+                        fail = nodes[fail].fail;
+                    }
+                    uint32_t target = child(fail, word);
+                    fail = target != NO_NODE ? target : ROOT;
+                }
+                nodes[next].fail = fail;
+                nodes[next].output = nodes[fail].pattern != NO_PATTERN ? fail : nodes[fail].output;
+                queue.push(next);
+            }
+        }
+    }
+
+    bool empty() const {
+        return canonicals.empty();
+    }
+
+    uint32_t wordId(std::string_view word) const {
+        auto it = vocabulary.find(word);
+        return it != vocabulary.end() ? it->second : UNKNOWN_WORD;
+    }
+
+    uint32_t step(uint32_t state, uint32_t word) const {
+        if (word == UNKNOWN_WORD) {
+            return ROOT;
+        }
+        while (true) {
+            uint32_t next = child(state, word);
+            if (next != NO_NODE) {
+                return next;
+            }
+            if (state == ROOT) {
+                return ROOT;
+            }
+            state = nodes[state].fail;
+        }
+    }
+
+    //   ,    : visit( ,  )
+    template <typename Visitor>
+    void forEachMatch(uint32_t state, Visitor visit) const {
+        uint32_t node = nodes[state].pattern != NO_PATTERN ? state : nodes[state].output;
+        while (node != ROOT) {
+            visit(nodes[node].depth, std::string_view(canonicals[nodes[node].pattern]));
+            node = nodes[node].output;
+        }
+    }
+};
+
+//     ->  ; std::nullopt   
+struct SynonymEdit {
+    std::string synonym;
+    std::optional<std::string> previous_canonical;
+    std::optional<std::string> new_canonical;
+};
+
+//  - (HAMT)   ->  , 
+//   .        :
+//   13   32       ,  
+//     .       ; , 
+//    ,   .
+class SynonymMap {
+public:
+    struct Entry {
+        uint64_t hash;
+        std::string synonym;
+        // std::nullopt:     
+        std::optional<std::string> canonical;
+    };
+
+private:
+    static constexpr unsigned BITS = 5;
+    static constexpr size_t LEAF_CAPACITY = 8;
+
+    //  (bitmap != 0)     ,  - 
+    struct Node {
+        uint32_t bitmap = 0;
+        std::vector<std::shared_ptr<Node>> children;
+        std::vector<Entry> entries;
+
+        bool isLeaf() const {
+            return bitmap == 0;
+        }
+    };
+
+    std::shared_ptr<Node> root;
+    size_t count = 0;
+
+    static uint64_t hashOf(std::string_view synonym) {
+        return StringHash{}(synonym);
+    }
+
+    // ,     : ,     , 
+    static std::shared_ptr<Node> own(const std::shared_ptr<Node>& node) {
+        if (!node) {
+            return std::make_shared<Node>();
+        }
+        return node.use_count() == 1 ? node : std::make_shared<Node>(*node);
+    }
+
+    static size_t childIndex(const Node& node, uint32_t bit) {
+        return static_cast<size_t>(std::popcount(node.bitmap & (bit - 1)));
+    }
+
+    static void insert(std::shared_ptr<Node>& slot, unsigned shift, Entry&& entry, size_t& added) {
+        slot = own(slot);
+        Node& node = *slot;
+        if (node.isLeaf()) {
+            for (auto& existing : node.entries) {
+                if (existing.hash == entry.hash && existing.synonym == entry.synonym) {
+                    existing.canonical = std::move(entry.canonical);
+                    return;
+                }
+            }
+            ++added;
+            if (node.entries.size() < LEAF_CAPACITY || shift >= 64) {
+                node.entries.push_back(std::move(entry));
+                return;
+            }
+            //    
+            std::vector<Entry> moved = std::move(node.entries);
+            node.entries.clear();
+            moved.push_back(std::move(entry));
+            size_t ignored = 0;
+            for (auto& item : moved) {
+                insertIntoBranch(node, shift, std::move(item), ignored);
+            }
+            return;
+        }
+        insertIntoBranch(node, shift, std::move(entry), added);
+    }
+
+    static void insertIntoBranch(Node& node, unsigned shift, Entry&& entry, size_t& added) {
+        uint32_t bit = 1u << ((entry.hash >> shift) & 31);
+        size_t index = childIndex(node, bit);
+        if ((node.bitmap & bit) == 0) {
+            node.bitmap |= bit;
+            node.children.insert(node.children.begin() + index, nullptr);
+        }
+        insert(node.children[index], shift + BITS, std::move(entry), added);
+    }
+
+    //  ,     
+    static void eraseExisting(std::shared_ptr<Node>& slot, unsigned shift, uint64_t hash, std::string_view synonym) {
+        slot = own(slot);
+        Node& node = *slot;
+        if (node.isLeaf()) {
+            node.entries.erase(std::find_if(node.entries.begin(), node.entries.end(), [&](const Entry& entry) {
+                return entry.hash == hash && entry.synonym == synonym;
+                }));
+            return;
+        }
+        uint32_t bit = 1u << ((hash >> shift) & 31);
+        size_t index = childIndex(node, bit);
+        eraseExisting(node.children[index], shift + BITS, hash, synonym);
+        const Node& child = *node.children[index];
+        if (child.isLeaf() && child.entries.empty()) {
+            node.children.erase(node.children.begin() + index);
+            node.bitmap &= ~bit;
+        }
+    }
+
+    template <typename Visitor>
+    static void forEachIn(const Node& node, Visitor& visit) {
+        for (const auto& entry : node.entries) {
+            visit(entry);
+        }
+        for (const auto& child : node.children) {
+            forEachIn(*child, visit);
+        }
+    }
+
+public:
+    bool empty() const {
+        return count == 0;
+    }
+
+    size_t size() const {
+        return count;
+    }
+
+    const Entry* find(std::string_view synonym) const {
+        if (!root) {
+            return nullptr;
+        }
+        uint64_t hash = hashOf(synonym);
+        const Node* node = root.get();
+        for (unsigned shift = 0; !node->isLeaf(); shift += BITS) {
+            uint32_t bit = 1u << ((hash >> shift) & 31);
+            if ((node->bitmap & bit) == 0) {
+                return nullptr;
+            }
+            node = node->children[childIndex(*node, bit)].get();
+        }
+        for (const auto& entry : node->entries) {
+            if (entry.hash == hash && entry.synonym == synonym) {
+                return &entry;
+            }
+        }
+        return nullptr;
+    }
+
+    void assign(std::string_view synonym, std::optional<std::string> canonical) {
+        insert(root, 0, Entry{ hashOf(synonym), std::string(synonym), std::move(canonical) }, count);
+    }
+
+    void erase(std::string_view synonym) {
+        if (find(synonym) != nullptr) {
+            eraseExisting(root, 0, hashOf(synonym), synonym);
+            --count;
+        }
+    }
+
+    //   ,    
+    template <typename Visitor>
+    void forEach(Visitor visit) const {
+        if (root) {
+            forEachIn(*root, visit);
+        }
+    }
+};
+
+//  ,       ;    
+struct PhraseCache {
+    std::once_flag built;
+    std::shared_ptr<const PhraseMatcher> matcher;
+};
+
+//   :       .
+// ,  ,        .
+class DictionaryVersion {
+private:
+    friend class DictionaryWriter;
+
+    std::shared_ptr<const CompiledDictionary> compiled;
+    SynonymMap overrides;
+    std::shared_ptr<PhraseCache> phrase_cache = std::make_shared<PhraseCache>();
+
+public:
+    DictionaryVersion() = default;
+
+    explicit DictionaryVersion(std::shared_ptr<const CompiledDictionary> compiled_dictionary)
+        : compiled(std::move(compiled_dictionary)) {}
+
+    explicit DictionaryVersion(SynonymMap synonyms)
+        : overrides(std::move(synonyms)) {}
+
+    static bool isPhrase(std::string_view synonym) {
+        return std::find_if(synonym.begin(), synonym.end(), TextScanner::isSpace) != synonym.end();
+    }
+
+    bool findCanonical(std::string_view word, std::string_view& canonical) const {
+        if (!overrides.empty()) {
+            if (const SynonymMap::Entry* entry = overrides.find(word)) {
+                if (!entry->canonical) {
+                    return false;
+                }
+                canonical = *entry->canonical;
+                return true;
+            }
+        }
+        return compiled && compiled->find(word, canonical);
+    }
+
+    //     ;     ,   .
+    //  ,   .
+    std::string_view getCanonicalView(std::string_view word) const {
+        std::string_view canonical;
+        return findCanonical(word, canonical) ? canonical : word;
+    }
+
+    //    : visit(,  )
+    template <typename Visitor>
+    void forEachSynonym(Visitor visit) const {
+        if (compiled) {
+            compiled->forEachEntry([&](std::string_view canonical, std::string_view synonym) {
+                if (overrides.empty() || overrides.find(synonym) == nullptr) {
+                    visit(synonym, canonical);
+                }
+                });
+        }
+        overrides.forEach([&](const SynonymMap::Entry& entry) {
+            if (entry.canonical) {
+                visit(std::string_view(entry.synonym), std::string_view(*entry.canonical));
+            }
+            });
+    }
+
+    //   ,    
+    DictionaryEntries entries() const {
+        DictionaryEntries result;
+        std::unordered_map<std::string_view, size_t> positions;
+        forEachSynonym([&](std::string_view synonym, std::string_view canonical) {
+            auto inserted = positions.emplace(canonical, result.size());
+            if (inserted.second) {
+                result.emplace_back(std::string(canonical), std::vector<std::string>());
+            }
+            result[inserted.first->second].second.emplace_back(synonym);
+            });
+        return result;
+    }
+
+    //      ;     
+    std::shared_ptr<const PhraseMatcher> phrases() const {
+        std::call_once(phrase_cache->built, [this]() {
+            auto matcher = std::make_shared<PhraseMatcher>();
+            forEachSynonym([&](std::string_view synonym, std::string_view canonical) {
+                if (isPhrase(synonym)) {
+                    matcher->addPhrase(synonym, canonical);
+                }
+                });
+            matcher->build();
+            phrase_cache->matcher = std::move(matcher);
+            });
+        return phrase_cache->matcher;
+    }
+};
+
+//    .       
+//          .
+class DictionaryWriter {
+private:
+    std::shared_ptr<DictionaryVersion> draft;
+    bool phrases_changed = false;
+
+    void touch(std::string_view synonym) {
+        if (!phrases_changed && DictionaryVersion::isPhrase(synonym)) {
+            phrases_changed = true;
+        }
+    }
+
+public:
+    explicit DictionaryWriter(const DictionaryVersion& origin)
+        : draft(std::make_shared<DictionaryVersion>(origin)) {}
+
+    const DictionaryVersion& version() const {
+        return *draft;
+    }
+
+    //          
+    SynonymEdit assignSynonym(const std::string& synonym, const std::string& canonical_word) {
+        SynonymEdit edit{ synonym, std::nullopt, canonical_word };
+        std::string_view current;
+        if (draft->findCanonical(synonym, current)) {
+            edit.previous_canonical = std::string(current);
+            if (current == canonical_word) {
+                return edit;
+            }
+        }
+
+        draft->overrides.assign(synonym, canonical_word);
+        touch(synonym);
+        return edit;
+    }
+
+    //           
+    SynonymEdit eraseSynonym(const std::string& synonym) {
+        SynonymEdit edit{ synonym, std::nullopt, std::nullopt };
+        std::string_view current;
+        if (!draft->findCanonical(synonym, current)) {
+            return edit;
+        }
+        edit.previous_canonical = std::string(current);
+
+        //        
+        if (draft->compiled && draft->compiled->find(synonym, current)) {
+            draft->overrides.assign(synonym, std::nullopt);
+        }
+        else {
+            draft->overrides.erase(synonym);
+        }
+        touch(synonym);
+        return edit;
+    }
+
+    SynonymEdit revertEdit(const SynonymEdit& edit) {
+        if (edit.previous_canonical) {
+            return assignSynonym(edit.synonym, *edit.previous_canonical);
+        }
+        return eraseSynonym(edit.synonym);
+    }
+
+    //       
+    std::shared_ptr<const DictionaryVersion> publish() {
+        if (phrases_changed) {
+            draft->phrase_cache = std::make_shared<PhraseCache>();
+        }
+        return std::move(draft);
+    }
+};
+
+//    :     ,
+//           (  RCU).
+//   ,     .
 class SynonymDictionary {
 private:
-    std::unordered_map<std::string, std::string> synonym_map;
-    std::unordered_map<std::string, std::vector<std::string>> canonical_map;
+    std::atomic<std::shared_ptr<const DictionaryVersion>> current{ std::make_shared<const DictionaryVersion>() };
+    std::mutex write_mutex;
+
+    void publish(std::shared_ptr<const DictionaryVersion> version) {
+        std::lock_guard<std::mutex> lock(write_mutex);
+        current.store(std::move(version));
+    }
 
 public:
     SynonymDictionary() = default;
     ~SynonymDictionary() = default;
 
+    //  ;   ,       
+    std::shared_ptr<const DictionaryVersion> snapshot() const {
+        return current.load();
+    }
+
+    //  mutate(DictionaryWriter&)   :      
+    template <typename Mutator>
+    auto update(Mutator mutate) {
+        std::lock_guard<std::mutex> lock(write_mutex);
+        DictionaryWriter writer(*current.load());
+        if constexpr (std::is_void_v<decltype(mutate(writer))>) {
+            mutate(writer);
+            current.store(writer.publish());
+        }
+        else {
+            auto result = mutate(writer);
+            current.store(writer.publish());
+            return result;
+        }
+    }
+
     void loadFromFile(const std::string& filename) {
+        if (CompiledDictionary::isCompiled(filename)) {
+            publish(std::make_shared<const DictionaryVersion>(std::make_shared<const CompiledDictionary>(filename)));
+            return;
+        }
+
         std::ifstream file(filename);
         if (!file.is_open()) {
             throw std::runtime_error("Could not open file: " + filename);
         }
 
-        std::string line;
-        while (std::getline(file, line)) {
-            parseLine(line);
+        SynonymMap layer;
+        std::string line;
+        std::string canonical_word;
+        std::vector<std::string> synonyms;
+        while (std::getline(file, line)) {
+            if (parseEntry(line, canonical_word, synonyms)) {
+                for (auto& synonym : synonyms) {
+                    layer.assign(synonym, canonical_word);
+                }
+            }
+        }
+        file.close();
+        publish(std::make_shared<const DictionaryVersion>(std::move(layer)));
+    }
+
+    DictionaryEntries entries() const {
+        return snapshot()->entries();
+    }
+
+    void saveToFile(const std::string& filename) const {
+        writeEntries(filename, entries());
+    }
+
+    //        
+    static void writeEntries(const std::string& filename, const DictionaryEntries& entries) {
+        std::string temp_filename = filename + ".tmp";
+        std::ofstream file(temp_filename);
+
+        if (!file.is_open()) {
+            throw std::runtime_error("Could not open file: " + temp_filename);
+        }
+
+        for (const auto& entry : entries) {
+            file << entry.first << "{";
+            for (size_t i = 0; i < entry.second.size(); ++i) {
+                file << entry.second[i];
+                if (i < entry.second.size() - 1) {
+                    file << ", ";
+                }
+            }
+            file << "}\n";
+        }
+        file.close();
+        if (!file) {
+            throw std::runtime_error("Could not write file: " + temp_filename);
+        }
+        std::filesystem::rename(temp_filename, filename);
+    }
+
+    void compileToFile(const std::string& filename) const {
+        CompiledDictionary::compile(filename, entries());
+    }
+
+    std::string getCanonicalWord(const std::string& word) const {
+        return std::string(snapshot()->getCanonicalView(word));
+    }
+
+    SynonymEdit assignSynonym(const std::string& synonym, const std::string& canonical_word) {
+        return update([&](DictionaryWriter& writer) {
+            return writer.assignSynonym(synonym, canonical_word);
+            });
+    }
+
+    SynonymEdit eraseSynonym(const std::string& synonym) {
+        return update([&](DictionaryWriter& writer) {
+            return writer.eraseSynonym(synonym);
+            });
+    }
+
+    SynonymEdit revertEdit(const SynonymEdit& edit) {
+        return update([&](DictionaryWriter& writer) {
+            return writer.revertEdit(edit);
+            });
+    }
+
+    std::vector<SynonymEdit> addEntry(const std::string& canonical_word, const std::vector<std::string>& synonyms) {
+        return update([&](DictionaryWriter& writer) {
+            std::vector<SynonymEdit> edits;
+            edits.reserve(synonyms.size());
+            for (const auto& synonym : synonyms) {
+                edits.push_back(writer.assignSynonym(synonym, canonical_word));
+            }
+            return edits;
+            });
+    }
+
+    SynonymEdit addSynonym(const std::string& canonical_word, const std::string& synonym) {
+        return assignSynonym(synonym, canonical_word);
+    }
+
+    void removeSynonym(const std::string& canonical_word, const std::string& synonym) {
+        update([&](DictionaryWriter& writer) {
+            std::string_view current_canonical;
+            if (writer.version().findCanonical(synonym, current_canonical) && current_canonical == canonical_word) {
+                writer.eraseSynonym(synonym);
+            }
+            });
+    }
+
+    //    canonical{a, b, c}
+    static bool parseEntry(const std::string& line, std::string& canonical_word, std::vector<std::string>& synonyms) {
+        std::istringstream stream(line);
+        synonyms.clear();
+
+        if (std::getline(stream, canonical_word, '{')) {
+            std::string synonyms_list;
+
+            if (std::getline(stream, synonyms_list, '}')) {
+                std::istringstream synonyms_stream(synonyms_list);
+                std::string synonym;
+
+                while (std::getline(synonyms_stream, synonym, ',')) {
+                    synonym.erase(0, synonym.find_first_not_of(" \t\n\r"));
+                    synonym.erase(synonym.find_last_not_of(" \t\n\r") + 1);
+                    synonyms.push_back(synonym);
+                }
+                return true;
+            }
+        }
+        return false;
+    }
+
+    //     ,    
+    static DictionaryEntries readEntries(const std::string& filename) {
+        std::ifstream file(filename);
+        if (!file.is_open()) {
+            throw std::runtime_error("Could not open file: " + filename);
+        }
+
+        DictionaryEntries entries;
+        std::string line;
+        std::string canonical_word;
+        std::vector<std::string> synonyms;
+        while (std::getline(file, line)) {
+            if (parseEntry(line, canonical_word, synonyms)) {
+                entries.emplace_back(canonical_word, synonyms);
+            }
+        }
+        return entries;
+    }
+
+    //            
+    std::vector<SynonymEdit> addEntries(const DictionaryEntries& entries) {
+        size_t total = 0;
+        for (const auto& entry : entries) {
+            total += entry.second.size();
+        }
+        return update([&](DictionaryWriter& writer) {
+            std::vector<SynonymEdit> edits;
+            edits.reserve(total);
+            for (const auto& entry : entries) {
+                for (const auto& synonym : entry.second) {
+                    edits.push_back(writer.assignSynonym(synonym, entry.first));
+                }
+            }
+            return edits;
+            });
+    }
+};
+
+//       
+class ThreadPool {
+private:
+    std::vector<std::thread> workers;
+    std::queue<std::function<void()>> tasks;
+    std::mutex tasks_mutex;
+    std::condition_variable tasks_available;
+    bool stopping = false;
+
+public:
+    explicit ThreadPool(unsigned worker_count) {
+        if (worker_count == 0) {
+            worker_count = 1;
+        }
+        for (unsigned i = 0; i < worker_count; ++i) {
+            workers.emplace_back([this]() {
+                while (true) {
+                    std::function<void()> task;
+                    {
+                        std::unique_lock<std::mutex> lock(tasks_mutex);
+                        tasks_available.wait(lock, [this]() { return stopping || !tasks.empty(); });
+                        if (stopping && tasks.empty()) {
+                            return;
+                        }
+                        task = std::move(tasks.front());
+                        tasks.pop();
+                    }
+                    task();
+                }
+                });
+        }
+    }
+
+    ~ThreadPool() {
+        {
+            std::lock_guard<std::mutex> lock(tasks_mutex);
+            stopping = true;
+        }
+        tasks_available.notify_all();
+        for (auto& worker : workers) {
+            worker.join();
+        }
+    }
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    size_t size() const {
+        return workers.size();
+    }
+
+    template <typename Task>
+    auto submit(Task task) -> std::future<decltype(task())> {
+        using Result = decltype(task());
+        auto packaged = std::make_shared<std::packaged_task<Result()>>(std::move(task));
+        std::future<Result> result = packaged->get_future();
+        {
+            std::lock_guard<std::mutex> lock(tasks_mutex);
+            tasks.emplace([packaged]() { (*packaged)(); });
+        }
+        tasks_available.notify_one();
+        return result;
+    }
+};
+
+//   : -      ,
+//        
+class UnknownWordCounter {
+private:
+    static constexpr size_t SHARD_COUNT = 64;
+
+    struct Shard {
+        std::mutex mutex;
+        std::unordered_map<std::string, uint64_t, StringHash, std::equal_to<>> counts;
+    };
+
+    std::array<Shard, SHARD_COUNT> shards;
+
+public:
+    void add(std::string_view word, uint64_t count = 1) {
+        Shard& shard = shards[StringHash{}(word) % SHARD_COUNT];
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        auto it = shard.counts.find(word);
+        if (it != shard.counts.end()) {
+            it->second += count;
+        }
+        else {
+            shard.counts.emplace(std::string(word), count);
+        }
+    }
+
+    //    
+    std::vector<std::pair<std::string, uint64_t>> ranked() {
+        std::vector<std::pair<std::string, uint64_t>> result;
+        for (auto& shard : shards) {
+            std::lock_guard<std::mutex> lock(shard.mutex);
+            result.insert(result.end(), shard.counts.begin(), shard.counts.end());
+        }
+        std::sort(result.begin(), result.end(), [](const auto& a, const auto& b) {
+            return a.second != b.second ? a.second > b.second : a.first < b.first;
+        });
+        return result;
+    }
+};
+
+class TextProcessor {
+private:
+    //  :       
+    struct Token {
+        std::string_view lead;
+        std::string_view core;
+        std::string_view trail;
+        std::string_view replacement;
+        bool matched = false;
+        uint32_t phrase_length = 0;
+        std::string_view phrase_canonical;
+    };
+
+    SynonymDictionary& dictionary;
+    //  ,     ;  
+    //      
+    std::shared_ptr<const DictionaryVersion> snapshot;
+    unsigned worker_count;
+    size_t chunk_size;
+    bool ignore_case = false;
+
+    //    ;          
+    bool lookup(std::string_view word, std::string_view& canonical, std::string& folded) const {
+        if (snapshot->findCanonical(word, canonical)) {
+            return true;
+        }
+        return ignore_case && TextScanner::foldCase(word, folded) && snapshot->findCanonical(folded, canonical);
+    }
+
+    uint32_t phraseWordId(const PhraseMatcher& phrases, std::string_view word, std::string& folded) const {
+        uint32_t id = phrases.wordId(word);
+        if (id == PhraseMatcher::UNKNOWN_WORD && ignore_case && TextScanner::foldCase(word, folded)) {
+            id = phrases.wordId(folded);
         }
-        file.close();
+        return id;
     }
 
-    void saveToFile(const std::string& filename) const {
-        std::ofstream file(filename);
+    static bool isPunctuation(char c) {
+        unsigned char byte = static_cast<unsigned char>(c);
+        return byte < 0x80 && std::ispunct(byte);
+    }
 
-        if (!file.is_open()) {
-            throw std::runtime_error("Could not open file: " + filename);
+    //    ,    
+    size_t chunkEnd(std::string_view text, size_t begin) const {
+        if (text.size() - begin <= chunk_size) {
+            return text.size();
         }
+        size_t newline = text.find('\n', begin + chunk_size - 1);
+        return newline == std::string_view::npos ? text.size() : newline + 1;
+    }
 
-        for (const auto& entry : canonical_map) {
-            file << entry.first << "{";
-            for (size_t i = 0; i < entry.second.size(); ++i) {
-                file << entry.second[i];
-                if (i < entry.second.size() - 1) {
-                    file << ", ";
+    //            ,
+    //   ;        
+    void matchLine(std::string_view line, const PhraseMatcher& phrases, std::vector<Token>& tokens, std::string& folded) const {
+        tokens.clear();
+        TextScanner::forEachWord(line, [&](std::string_view word) {
+            Token token;
+            std::string_view canonical;
+            if (lookup(word, canonical, folded)) {
+                token.core = word;
+                token.matched = true;
+                token.replacement = canonical;
+            }
+            else {
+                size_t begin = 0;
+                while (begin < word.size() && isPunctuation(word[begin])) {
+                    ++begin;
+                }
+                size_t end = word.size();
+                while (end > begin && isPunctuation(word[end - 1])) {
+                    --end;
+                }
+                token.lead = word.substr(0, begin);
+                token.core = word.substr(begin, end - begin);
+                token.trail = word.substr(end);
+                if (token.core.size() != word.size() && !token.core.empty() && lookup(token.core, canonical, folded)) {
+                    token.matched = true;
+                    token.replacement = canonical;
                 }
             }
-            file << "}\n";
+            tokens.push_back(token);
+            });
+
+        if (phrases.empty()) {
+            return;
+        }
+        uint32_t state = PhraseMatcher::ROOT;
+        for (size_t i = 0; i < tokens.size(); ++i) {
+            const Token& token = tokens[i];
+            if (!token.lead.empty() || token.core.empty()) {
+                state = PhraseMatcher::ROOT;
+            }
+            if (token.core.empty()) {
+                continue;
+            }
+            state = phrases.step(state, phraseWordId(phrases, token.core, folded));
+            phrases.forEachMatch(state, [&](uint32_t length, std::string_view canonical) {
+                Token& first = tokens[i + 1 - length];
+                if (length > first.phrase_length) {
+                    first.phrase_length = length;
+                    first.phrase_canonical = canonical;
+                }
+                });
+            if (!token.trail.empty()) {
+                state = PhraseMatcher::ROOT;
+            }
         }
-        file.close();
     }
 
-    std::string getCanonicalWord(const std::string& word) const {
-        auto it = synonym_map.find(word);
-        return it != synonym_map.end() ? it->second : word;
+    //  ,      
+    template <typename Visitor>
+    static void forEachUnmatched(const std::vector<Token>& tokens, Visitor visit) {
+        size_t i = 0;
+        while (i < tokens.size()) {
+            const Token& token = tokens[i];
+            if (token.phrase_length > 1) {
+                i += token.phrase_length;
+                continue;
+            }
+            if (!token.matched && !token.core.empty()) {
+                visit(token.core);
+            }
+            ++i;
+        }
     }
 
-    void addEntry(const std::string& canonical_word, const std::vector<std::string>& synonyms) {
-        for (const auto& synonym : synonyms) {
-            synonym_map[synonym] = canonical_word;
+    //  ,      
+    static void emitLine(const std::vector<Token>& tokens, std::string& out) {
+        size_t i = 0;
+        while (i < tokens.size()) {
+            const Token& token = tokens[i];
+            if (token.phrase_length > 1) {
+                out += token.lead;
+                out += token.phrase_canonical;
+                out += tokens[i + token.phrase_length - 1].trail;
+                i += token.phrase_length;
+            }
+            else {
+                out += token.lead;
+                out += token.matched ? token.replacement : token.core;
+                out += token.trail;
+                ++i;
+            }
+            out += ' ';
         }
-        canonical_map[canonical_word] = synonyms;
+        out += '\n';
     }
 
-    void addSynonym(const std::string& canonical_word, const std::string& synonym) {
-        synonym_map[synonym] = canonical_word;
-        canonical_map[canonical_word].push_back(synonym);
+    //    ;      
+    std::string normalizeChunk(std::string_view chunk, const PhraseMatcher& phrases, UnknownWordCounter* unknown_words) const {
+        std::string out;
+        out.reserve(chunk.size() + chunk.size() / 8);
+        std::vector<Token> tokens;
+        std::string folded;
+        std::unordered_map<std::string_view, uint64_t> local_unknown;
+
+        //        
+        size_t pos = 0;
+        while (pos < chunk.size()) {
+            size_t end = chunk.find('\n', pos);
+            if (end == std::string_view::npos) {
+                end = chunk.size();
+            }
+            matchLine(chunk.substr(pos, end - pos), phrases, tokens, folded);
+            if (unknown_words != nullptr) {
+                forEachUnmatched(tokens, [&](std::string_view word) {
+                    ++local_unknown[word];
+                    });
+            }
+            emitLine(tokens, out);
+            pos = end + 1;
+        }
+        //       
+        for (const auto& entry : local_unknown) {
+            unknown_words->add(entry.first, entry.second);
+        }
+        return out;
     }
 
-    void removeSynonym(const std::string& canonical_word, const std::string& synonym) {
-        auto it = synonym_map.find(synonym);
-        if (it != synonym_map.end() && it->second == canonical_word) {
-            synonym_map.erase(it);
-            auto& synonyms = canonical_map[canonical_word];
-            synonyms.erase(std::remove(synonyms.begin(), synonyms.end(), synonym), synonyms.end());
+    //  :      
+    //      
+    void processMapped(std::string_view text, const PhraseMatcher& phrases, UnknownWordCounter* unknown_words, std::ostream& output_file) const {
+        ThreadPool pool(worker_count);
+        std::deque<std::future<std::string>> pending;
+        const size_t max_pending = pool.size() * 2;
+
+        size_t begin = 0;
+        while (begin < text.size()) {
+            size_t end = chunkEnd(text, begin);
+            std::string_view chunk = text.substr(begin, end - begin);
+            pending.push_back(pool.submit([this, chunk, &phrases, unknown_words]() {
+                return normalizeChunk(chunk, phrases, unknown_words);
+            }));
+            begin = end;
+
+            if (pending.size() >= max_pending) {
+                std::string normalized = pending.front().get();
+                pending.pop_front();
+                output_file.write(normalized.data(), static_cast<std::streamsize>(normalized.size()));
+            }
+        }
+        while (!pending.empty()) {
+            std::string normalized = pending.front().get();
+            pending.pop_front();
+            output_file.write(normalized.data(), static_cast<std::streamsize>(normalized.size()));
         }
     }
 
-    void parseLine(const std::string& line) {
-        std::istringstream stream(line);
-        std::string canonical_word;
+public:
+    TextProcessor(SynonymDictionary& dict, unsigned workers = std::thread::hardware_concurrency(), size_t chunk_bytes = 1 << 20)
+        : dictionary(dict), worker_count(workers), chunk_size(chunk_bytes) {}
 
-        if (std::getline(stream, canonical_word, '{')) {
-            std::string synonyms_list;
+    //       ,    
+    void setIgnoreCase(bool enabled) {
+        ignore_case = enabled;
+    }
 
-            if (std::getline(stream, synonyms_list, '}')) {
-                std::istringstream synonyms_stream(synonyms_list);
-                std::string synonym;
-                std::vector<std::string> synonyms;
+    //  ;   ,    ,    
+    void processFile(const std::string& input_filename, const std::string& output_filename, UnknownWordCounter* unknown_words = nullptr) {
+        snapshot = dictionary.snapshot();
+        std::shared_ptr<const PhraseMatcher> phrases = snapshot->phrases();
 
-                while (std::getline(synonyms_stream, synonym, ',')) {
-                    synonym.erase(0, synonym.find_first_not_of(" \t\n\r"));
-                    synonym.erase(synonym.find_last_not_of(" \t\n\r") + 1);
-                    synonym_map[synonym] = canonical_word;
-                    synonyms.push_back(synonym);
-                }
+        std::unique_ptr<MappedFile> input;
+        try {
+            input = std::make_unique<MappedFile>(input_filename);
+        }
+        catch (const std::runtime_error&) {
+            throw std::runtime_error("Could not open input file: " + input_filename);
+        }
 
-                canonical_map[canonical_word] = synonyms;
-            }
+        std::ofstream output_file(output_filename);
+        if (!output_file.is_open()) {
+            throw std::runtime_error("Could not open output file: " + output_filename);
         }
+
+        processMapped(input->view(), *phrases, unknown_words, output_file);
+        snapshot.reset();
+        output_file.close();
     }
 };
 
-class TextProcessor {
+//  :       
+//       
+class UndoManager {
 private:
     SynonymDictionary& dictionary;
+    std::vector<std::vector<SynonymEdit>> actions;
+    size_t next = 0;
+    size_t count = 0;
 
 public:
-    TextProcessor(SynonymDictionary& dict) : dictionary(dict) {}
+    UndoManager(SynonymDictionary& dict, size_t capacity) : dictionary(dict), actions(capacity == 0 ? 1 : capacity) {}
 
-    void processFile(const std::string& input_filename, const std::string& output_filename, bool automatic_mode) {
-        std::ifstream input_file(input_filename);
-        if (!input_file.is_open()) {
-            throw std::runtime_error("Could not open input file: " + input_filename);
+    void recordAction(std::vector<SynonymEdit> edits) {
+        actions[next] = std::move(edits);
+        next = (next + 1) % actions.size();
+        if (count < actions.size()) {
+            ++count;
         }
+    }
 
-        std::ofstream output_file(output_filename);
+    //   N       
+    std::vector<SynonymEdit> undoLastActions(int N) {
+        std::vector<SynonymEdit> applied;
+        dictionary.update([&](DictionaryWriter& writer) {
+            for (int i = 0; i < N && count > 0; ++i) {
+                next = (next + actions.size() - 1) % actions.size();
+                --count;
+                auto& edits = actions[next];
+                for (auto it = edits.rbegin(); it != edits.rend(); ++it) {
+                    applied.push_back(writer.revertEdit(*it));
+                }
+                edits.clear();
+            }
+            });
+        return applied;
+    }
 
-        if (!output_file.is_open()) {
-            input_file.close();
-            throw std::runtime_error("Could not open output file: " + output_filename);
+    bool isEmpty() const {
+        return count == 0;
+    }
+};
+
+//    (write-ahead log).     
+//   ,       ,
+//      ,      .
+class DictionaryJournal {
+private:
+    static constexpr size_t SYNC_BATCH = 256;
+    static constexpr uint64_t COMPACT_THRESHOLD = 1 << 20;
+
+    std::string base_filename;
+    std::string compiled_filename;
+    std::string journal_filename;
+    std::string rotated_filename;
+    std::string buffer;
+    size_t pending_records = 0;
+    uint64_t journal_size = 0;
+    std::future<void> compaction;
+#ifdef _WIN32
+    HANDLE handle = INVALID_HANDLE_VALUE;
+#else
+    int descriptor = -1;
+#endif
+
+    void openJournal() {
+#ifdef _WIN32
+        handle = CreateFileA(journal_filename.c_str(), FILE_APPEND_DATA, FILE_SHARE_READ, nullptr,
+            OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+        if (handle == INVALID_HANDLE_VALUE) {
+            throw std::runtime_error("Could not open file: " + journal_filename);
+        }
+#else
+        descriptor = open(journal_filename.c_str(), O_WRONLY | O_CREAT | O_APPEND, 0644);
+        if (descriptor < 0) {
+            throw std::runtime_error("Could not open file: " + journal_filename);
         }
+#endif
+        std::error_code error;
+        journal_size = std::filesystem::file_size(journal_filename, error);
+        if (error) {
+            journal_size = 0;
+        }
+    }
 
-        std::string line;
-        while (std::getline(input_file, line)) {
-            std::istringstream line_stream(line);
-            std::string word;
-            while (line_stream >> word) {
-                std::string canonical_word = dictionary.getCanonicalWord(word);
-                if (canonical_word == word && dictionary.getCanonicalWord(word) == word) {
-                    if (!automatic_mode) {
-                        std::cout << "Word not in dictionary: " << word << std::endl;
-                        char option;
-                        std::cout << "Add to dictionary? (y/n): ";
-                        std::cin >> option;
-                        if (option == 'y' || option == 'Y') {
-                            std::cout << "Enter canonical word for " << word << ": ";
-                            std::string canon;
-                            std::cin >> canon;
-                            dictionary.addSynonym(canon, word);
-                        }
-                    }
+    void closeJournal() {
+#ifdef _WIN32
+        if (handle != INVALID_HANDLE_VALUE) {
+            CloseHandle(handle);
+            handle = INVALID_HANDLE_VALUE;
+        }
+#else
+        if (descriptor >= 0) {
+            close(descriptor);
+            descriptor = -1;
+        }
+#endif
+    }
+
+    //        
+    void sync() {
+        if (!buffer.empty()) {
+#ifdef _WIN32
+            DWORD written = 0;
+            if (!WriteFile(handle, buffer.data(), static_cast<DWORD>(buffer.size()), &written, nullptr)
+                || written != buffer.size()) {
+                throw std::runtime_error("Could not write file: " + journal_filename);
+            }
+#else
+            size_t offset = 0;
+            while (offset < buffer.size()) {
+                ssize_t written = write(descriptor, buffer.data() + offset, buffer.size() - offset);
+                if (written < 0) {
+                    throw std::runtime_error("Could not write file: " + journal_filename);
                 }
-                output_file << dictionary.getCanonicalWord(word) << " ";
+                offset += static_cast<size_t>(written);
             }
-            output_file << "\n";
+#endif
+            journal_size += buffer.size();
+            buffer.clear();
+        }
+        if (pending_records > 0) {
+#ifdef _WIN32
+            FlushFileBuffers(handle);
+#else
+            fsync(descriptor);
+#endif
+            pending_records = 0;
         }
-        input_file.close();
-        output_file.close();
     }
-};
 
-class UndoManager {
-private:
-    std::stack<std::function<void()>> undo_stack;
+    //   ;    
+    void waitForCompaction() {
+        if (compaction.valid()) {
+            compaction.get();
+        }
+    }
+
+    //      rotated_filename     
+    void appendToRotated() const {
+        std::string records;
+        {
+            //         
+            std::ifstream rotated(rotated_filename, std::ios::binary | std::ios::ate);
+            if (rotated && rotated.tellg() > 0) {
+                rotated.seekg(-1, std::ios::end);
+                if (rotated.get() != '\n') {
+                    records += '\n';
+                }
+            }
+            std::ifstream file(journal_filename, std::ios::binary);
+            records.append(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+        }
+#ifdef _WIN32
+        HANDLE rotated = CreateFileA(rotated_filename.c_str(), FILE_APPEND_DATA, FILE_SHARE_READ, nullptr,
+            OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+        if (rotated == INVALID_HANDLE_VALUE) {
+            throw std::runtime_error("Could not open file: " + rotated_filename);
+        }
+        DWORD written = 0;
+        bool ok = WriteFile(rotated, records.data(), static_cast<DWORD>(records.size()), &written, nullptr)
+            && written == records.size() && FlushFileBuffers(rotated);
+        CloseHandle(rotated);
+#else
+        int rotated = open(rotated_filename.c_str(), O_WRONLY | O_CREAT | O_APPEND, 0644);
+        if (rotated < 0) {
+            throw std::runtime_error("Could not open file: " + rotated_filename);
+        }
+        bool ok = true;
+        size_t offset = 0;
+        while (ok && offset < records.size()) {
+            ssize_t written = write(rotated, records.data() + offset, records.size() - offset);
+            ok = written >= 0;
+            offset += ok ? static_cast<size_t>(written) : 0;
+        }
+        ok = ok && fsync(rotated) == 0;
+        close(rotated);
+#endif
+        if (!ok) {
+            throw std::runtime_error("Could not write file: " + rotated_filename);
+        }
+    }
+
+    void writeBase(const DictionaryEntries& entries) const {
+        SynonymDictionary::writeEntries(base_filename, entries);
+        if (std::filesystem::exists(compiled_filename)) {
+            CompiledDictionary::compile(compiled_filename, entries);
+        }
+    }
+
+    static void applyRecords(const std::string& filename, SynonymDictionary& dict) {
+        std::ifstream file(filename, std::ios::binary);
+        if (!file.is_open()) {
+            return;
+        }
+
+        //     ,       
+        dict.update([&](DictionaryWriter& writer) {
+            std::string line;
+            while (std::getline(file, line)) {
+                //    (   ) 
+                if (file.eof() || line.size() < 2 || line[1] != '\t') {
+                    continue;
+                }
+                if (line[0] == '+') {
+                    size_t separator = line.find('\t', 2);
+                    if (separator != std::string::npos) {
+                        writer.assignSynonym(line.substr(2, separator - 2), line.substr(separator + 1));
+                    }
+                }
+                else if (line[0] == '-') {
+                    writer.eraseSynonym(line.substr(2));
+                }
+            }
+            });
+    }
 
 public:
-    void addUndoAction(const std::function<void()>& action) {
-        undo_stack.push(action);
+    DictionaryJournal(const std::string& base, const std::string& compiled, const std::string& journal)
+        : base_filename(base), compiled_filename(compiled), journal_filename(journal), rotated_filename(journal + ".old") {
+        openJournal();
+    }
+
+    ~DictionaryJournal() {
+        try {
+            sync();
+        }
+        catch (const std::runtime_error& e) {
+            std::cerr << "Error: " << e.what() << std::endl;
+        }
+        try {
+            waitForCompaction();
+        }
+        catch (const std::exception& e) {
+            //          
+            std::cerr << "Error: " << e.what() << std::endl;
+        }
+        closeJournal();
+    }
+
+    DictionaryJournal(const DictionaryJournal&) = delete;
+    DictionaryJournal& operator=(const DictionaryJournal&) = delete;
+
+    //     ,     
+    void replay(SynonymDictionary& dict) const {
+        applyRecords(rotated_filename, dict);
+        applyRecords(journal_filename, dict);
     }
 
-    void undoLastActions(int N) {
-        for (int i = 0; i < N && !undo_stack.empty(); ++i) {
-            undo_stack.top()();
-            undo_stack.pop();
+    void record(const SynonymEdit& edit) {
+        if (edit.new_canonical) {
+            buffer += "+\t";
+            buffer += edit.synonym;
+            buffer += '\t';
+            buffer += *edit.new_canonical;
+        }
+        else {
+            buffer += "-\t";
+            buffer += edit.synonym;
+        }
+        buffer += '\n';
+        if (++pending_records >= SYNC_BATCH) {
+            sync();
         }
     }
 
-    bool isEmpty() const {
-        return undo_stack.empty();
+    void record(const std::vector<SynonymEdit>& edits) {
+        for (const auto& edit : edits) {
+            record(edit);
+        }
+    }
+
+    //   :      
+    //    .   
+    //  ;         
+    void commit(const SynonymDictionary& dict) {
+        sync();
+        if (compaction.valid() && compaction.wait_for(std::chrono::seconds(0)) == std::future_status::ready) {
+            compaction.get();
+        }
+        if (journal_size < COMPACT_THRESHOLD) {
+            return;
+        }
+
+        waitForCompaction();
+        closeJournal();
+        // rotated_filename    ,      
+        // :    ,    
+        try {
+            if (std::filesystem::exists(rotated_filename)) {
+                appendToRotated();
+                std::filesystem::remove(journal_filename);
+            }
+            else {
+                std::filesystem::rename(journal_filename, rotated_filename);
+            }
+        }
+        catch (...) {
+            openJournal();
+            throw;
+        }
+        openJournal();
+
+        compaction = std::async(std::launch::async, [this, entries = dict.entries()]() {
+            writeBase(entries);
+            std::filesystem::remove(rotated_filename);
+            });
+    }
+
+    //    compiled_filename.      ,
+    //    
+    void compile(const SynonymDictionary& dict) {
+        try {
+            waitForCompaction();
+        }
+        catch (const std::exception&) {
+            // rotated_filename   ,      
+            //   ;     
+        }
+        dict.compileToFile(compiled_filename);
+    }
+
+    //       
+    void checkpoint(const SynonymDictionary& dict) {
+        sync();
+        try {
+            waitForCompaction();
+        }
+        catch (const std::exception&) {
+            //      
+        }
+        writeBase(dict.entries());
+
+        closeJournal();
+        std::filesystem::remove(rotated_filename);
+        std::filesystem::remove(journal_filename);
+        openJournal();
     }
 };
 
-void inputSynonym(SynonymDictionary& dict, UndoManager& undoManager) {
+void inputSynonym(SynonymDictionary& dict, UndoManager& undoManager, DictionaryJournal& journal) {
     std::string canon_word;
     std::string synonym;
 
@@ -182,20 +2003,14 @@ void inputSynonym(SynonymDictionary& dict, UndoManager& undoManager) {
     std::cout << "Enter synonym: ";
     std::cin >> synonym;
 
-    //    
-    auto currentState = dict;
-
-    //   
-    undoManager.addUndoAction([currentState, &dict]() {
-        dict = currentState;
-        });
-
-    //    
-    dict.addSynonym(canon_word, synonym);
-    dict.saveToFile("synonyms.txt");
+    //    ,        
+    SynonymEdit edit = dict.addSynonym(canon_word, synonym);
+    journal.record(edit);
+    journal.commit(dict);
+    undoManager.recordAction({ edit });
 }
 
-void addNewWord(SynonymDictionary& dict, UndoManager& undoManager) {
+void addNewWord(SynonymDictionary& dict, UndoManager& undoManager, DictionaryJournal& journal) {
     std::string canon_word;
     std::vector<std::string> synonyms;
     std::string synonym;
@@ -208,68 +2023,341 @@ void addNewWord(SynonymDictionary& dict, UndoManager& undoManager) {
         synonyms.push_back(synonym);
     }
 
-    undoManager.addUndoAction([canon_word, synonyms, &dict]() {
-        for (const auto& s : synonyms) {
-            dict.removeSynonym(canon_word, s);
-        }
-        //       
-        dict.saveToFile("synonyms.txt");
-        });
-
-    dict.addEntry(canon_word, synonyms);
-    //        
-    dict.saveToFile("synonyms.txt");
+    std::vector<SynonymEdit> edits = dict.addEntry(canon_word, synonyms);
+    //        
+    journal.record(edits);
+    journal.commit(dict);
+    undoManager.recordAction(std::move(edits));
 }
 
-void processText(bool learning_mode, SynonymDictionary& dict, UndoManager& undoManager) {
+void processText(bool learning_mode, SynonymDictionary& dict, UndoManager& undoManager, DictionaryJournal& journal, bool ignore_case) {
     std::string input_filename = "input.txt";
     std::string output_filename = "output.txt";
+    std::string report_filename = "unknown_words.txt";
+    const size_t REPORT_TOP = 20;
 
     TextProcessor processor(dict);
-    std::unordered_set<std::string> unknown_words;
-
-    //  
-    processor.processFile(input_filename, output_filename, learning_mode);
-
-    //       
-    if (learning_mode && !unknown_words.empty()) {
-        std::cout << "Learning mode activated. Adding unknown words to dictionary..." << std::endl;
-        for (const auto& word : unknown_words) {
-            char option;
-            std::cout << "Unknown word found: " << word << std::endl;
-            std::cout << "Do you want to add it to the dictionary? (y/n): ";
-            std::cin >> option;
-            if (option == 'y' || option == 'Y') {
-                std::string canonical_word;
-                std::cout << "Enter canonical word for " << word << ": ";
-                std::cin >> canonical_word;
-                if (dict.getCanonicalWord(word) != word) {
-                    std::cout << "This word already exists in the dictionary. Do you want to replace it? (y/n): ";
-                    std::cin >> option;
-                    if (option == 'y' || option == 'Y') {
-                        dict.removeSynonym(dict.getCanonicalWord(word), word);
-                        dict.addSynonym(canonical_word, word);
-                    }
-                }
-                else {
-                    dict.addSynonym(canonical_word, word);
-                }
+    processor.setIgnoreCase(ignore_case);
+
+    if (!learning_mode) {
+        processor.processFile(input_filename, output_filename);
+        return;
+    }
+
+    //  :        
+    UnknownWordCounter unknown_words;
+    processor.processFile(input_filename, output_filename, &unknown_words);
+    auto ranked = unknown_words.ranked();
+    if (ranked.empty()) {
+        std::cout << "All words are in the dictionary." << std::endl;
+        return;
+    }
+
+    std::ofstream report(report_filename);
+    if (!report.is_open()) {
+        throw std::runtime_error("Could not open file: " + report_filename);
+    }
+    for (const auto& entry : ranked) {
+        report << entry.first << " " << entry.second << "\n";
+    }
+    report.close();
+
+    std::cout << "Unknown words: " << ranked.size() << " (full report in " << report_filename << ")" << std::endl;
+    for (size_t i = 0; i < ranked.size() && i < REPORT_TOP; ++i) {
+        std::cout << "  " << ranked[i].first << " " << ranked[i].second << std::endl;
+    }
+
+    //             
+    std::string assignments_filename;
+    std::cout << "Enter file with canonical assignments, e.g. canonical{word1, word2} (or - to skip): ";
+    std::cin >> assignments_filename;
+    if (assignments_filename == "-") {
+        return;
+    }
+
+    DictionaryEntries assignments = SynonymDictionary::readEntries(assignments_filename);
+    std::vector<SynonymEdit> edits = dict.addEntries(assignments);
+    journal.record(edits);
+    journal.commit(dict);
+    std::cout << "Added " << edits.size() << " synonyms." << std::endl;
+    undoManager.recordAction(std::move(edits));
+}
+
+//      (rejection-inversion, Hormann  Derflinger);
+//    ,        
+class ZipfSampler {
+private:
+    double exponent;
+    double n;
+    double h_integral_x1;
+    double h_integral_n;
+    double s;
+
+    static double helper1(double x) {
+        return std::abs(x) > 1e-8 ? std::log1p(x) / x : 1 - x * (0.5 - x * (1.0 / 3 - 0.25 * x));
+    }
+
+    static double helper2(double x) {
+        return std::abs(x) > 1e-8 ? std::expm1(x) / x : 1 + x * 0.5 * (1 + x * (1.0 / 3) * (1 + 0.25 * x));
+    }
+
+    double h(double x) const {
+        return std::exp(-exponent * std::log(x));
+    }
+
+    double hIntegral(double x) const {
+        double log_x = std::log(x);
+        return helper2((1 - exponent) * log_x) * log_x;
+    }
+
+    double hIntegralInverse(double x) const {
+        double t = x * (1 - exponent);
+        if (t < -1) {
+            t = -1;
+        }
+        return std::exp(helper1(t) * x);
+    }
+
+public:
+    ZipfSampler(uint64_t elements, double zipf_exponent)
+        : exponent(zipf_exponent), n(static_cast<double>(elements)) {
+        h_integral_x1 = hIntegral(1.5) - 1;
+        h_integral_n = hIntegral(n + 0.5);
+        s = 2 - hIntegralInverse(hIntegral(2.5) - h(2));
+    }
+
+    //    1   
+    template <typename Engine>
+    uint64_t operator()(Engine& engine) {
+        std::uniform_real_distribution<double> uniform(0.0, 1.0);
+        while (true) {
+            double u = h_integral_n + uniform(engine) * (h_integral_x1 - h_integral_n);
+            double x = hIntegralInverse(u);
+            double k = std::floor(x + 0.5);
+            if (k < 1) {
+                k = 1;
+            }
+            else if (k > n) {
+                k = n;
+            }
+            if (k - x <= s || u >= hIntegral(k + 0.5) - h(k)) {
+                return static_cast<uint64_t>(k);
+            }
+        }
+    }
+};
+
+//      
+size_t peakMemoryBytes() {
+#ifdef _WIN32
+    PROCESS_MEMORY_COUNTERS counters;
+    if (GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters))) {
+        return counters.PeakWorkingSetSize;
+    }
+    return 0;
+#else
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0) {
+        return 0;
+    }
+#ifdef __APPLE__
+    return static_cast<size_t>(usage.ru_maxrss);
+#else
+    return static_cast<size_t>(usage.ru_maxrss) * 1024;
+#endif
+#endif
+}
+
+//      ;     
+std::string syntheticWord(uint64_t id, char prefix) {
+    std::string word(1, prefix);
+    do {
+        word += static_cast<char>('a' + id % 26);
+        id /= 26;
+    } while (id > 0);
+    return word;
+}
+
+double secondsSince(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+//    :     ,  
+//   ,      
+void benchmarkDictionary(uint64_t entries, uint64_t fan_out, uint64_t corpus_tokens) {
+    const std::string text_filename = "bench_synonyms.txt";
+    const std::string compiled_filename = "bench_synonyms.dict";
+    const std::string input_filename = "bench_input.txt";
+    const std::string output_filename = "bench_output.txt";
+    std::mt19937_64 engine(entries * 31 + fan_out);
+
+    {
+        std::ofstream file(text_filename);
+        for (uint64_t canonical = 0; canonical * fan_out < entries; ++canonical) {
+            file << syntheticWord(canonical, 'c') << "{";
+            for (uint64_t j = 0; j < fan_out && canonical * fan_out + j < entries; ++j) {
+                file << (j > 0 ? ", " : "") << syntheticWord(canonical * fan_out + j, 's');
+            }
+            file << "}\n";
+        }
+    }
+
+    //  :      ,  
+    const uint64_t vocabulary_size = entries * 2;
+    std::vector<uint64_t> rank_to_word(vocabulary_size);
+    for (uint64_t i = 0; i < vocabulary_size; ++i) {
+        rank_to_word[i] = i;
+    }
+    std::shuffle(rank_to_word.begin(), rank_to_word.end(), engine);
+    auto corpusWord = [&](uint64_t rank) {
+        uint64_t id = rank_to_word[rank - 1];
+        return id < entries ? syntheticWord(id, 's') : syntheticWord(id - entries, 'u');
+    };
+
+    ZipfSampler zipf(vocabulary_size, 1.0);
+    std::vector<std::string> lookup_sample;
+    lookup_sample.reserve(1 << 20);
+    uint64_t input_bytes = 0;
+    {
+        std::ofstream file(input_filename, std::ios::binary);
+        std::string line;
+        for (uint64_t token = 0; token < corpus_tokens; ++token) {
+            std::string word = corpusWord(zipf(engine));
+            if (lookup_sample.size() < lookup_sample.capacity()) {
+                lookup_sample.push_back(word);
+            }
+            line += word;
+            if (token % 12 == 11 || token + 1 == corpus_tokens) {
+                line += '\n';
+                file << line;
+                input_bytes += line.size();
+                line.clear();
             }
+            else {
+                line += ' ';
+            }
+        }
+    }
+
+    SynonymDictionary text_dictionary;
+    auto start = std::chrono::steady_clock::now();
+    text_dictionary.loadFromFile(text_filename);
+    double text_load = secondsSince(start);
+
+    start = std::chrono::steady_clock::now();
+    text_dictionary.compileToFile(compiled_filename);
+    double compile_time = secondsSince(start);
+
+    SynonymDictionary compiled_dictionary;
+    start = std::chrono::steady_clock::now();
+    compiled_dictionary.loadFromFile(compiled_filename);
+    double compiled_load = secondsSince(start);
+
+    auto measureLookups = [&](const SynonymDictionary& dict) {
+        size_t checksum = 0;
+        auto snapshot = dict.snapshot();
+        auto begin = std::chrono::steady_clock::now();
+        for (const auto& word : lookup_sample) {
+            checksum += snapshot->getCanonicalView(word).size();
         }
+        double elapsed = secondsSince(begin);
+        volatile size_t sink = checksum;
+        (void)sink;
+        return lookup_sample.size() / elapsed;
+    };
+    double text_lookups = measureLookups(text_dictionary);
+    double compiled_lookups = measureLookups(compiled_dictionary);
+
+    auto measureProcessing = [&](SynonymDictionary& dict) {
+        TextProcessor processor(dict);
+        auto begin = std::chrono::steady_clock::now();
+        processor.processFile(input_filename, output_filename);
+        return secondsSince(begin);
+    };
+    double text_processing = measureProcessing(text_dictionary);
+    double compiled_processing = measureProcessing(compiled_dictionary);
+
+    std::cout << std::fixed << std::setprecision(3);
+    std::cout << "Entries: " << entries << ", fan-out: " << fan_out << ", corpus: " << corpus_tokens
+        << " tokens, " << input_bytes / (1024.0 * 1024.0) << " MiB" << std::endl;
+    std::cout << "  loadFromFile (text):      " << text_load << " s" << std::endl;
+    std::cout << "  compile:                  " << compile_time << " s" << std::endl;
+    std::cout << "  loadFromFile (compiled):  " << compiled_load << " s" << std::endl;
+    std::cout << std::setprecision(0);
+    std::cout << "  getCanonicalView (text):      " << text_lookups << " lookups/s" << std::endl;
+    std::cout << "  getCanonicalView (compiled):  " << compiled_lookups << " lookups/s" << std::endl;
+    std::cout << "  processFile (text):      " << corpus_tokens / text_processing << " tokens/s, "
+        << input_bytes / text_processing / (1024 * 1024) << " MiB/s" << std::endl;
+    std::cout << "  processFile (compiled):  " << corpus_tokens / compiled_processing << " tokens/s, "
+        << input_bytes / compiled_processing / (1024 * 1024) << " MiB/s" << std::endl;
+    std::cout << "  peak memory:             " << peakMemoryBytes() / (1024 * 1024) << " MiB" << std::endl;
+    std::cout << std::defaultfloat << std::setprecision(6);
+
+    std::error_code error;
+    for (const auto& filename : { text_filename, compiled_filename, input_filename, output_filename }) {
+        std::filesystem::remove(filename, error);
     }
 }
 
+//   : Num4 --bench [entries] [fan-out] [tokens]
+//       10^3  10^6 .
+int runBenchmark(int argc, char* argv[]) {
+    try {
+        uint64_t fan_out = argc > 3 ? std::stoull(argv[3]) : 4;
+        uint64_t corpus_tokens = argc > 4 ? std::stoull(argv[4]) : 2000000;
+        if (fan_out == 0) {
+            fan_out = 1;
+        }
+        if (argc > 2) {
+            benchmarkDictionary(std::stoull(argv[2]), fan_out, corpus_tokens);
+        }
+        else {
+            for (uint64_t entries = 1000; entries <= 1000000; entries *= 10) {
+                benchmarkDictionary(entries, fan_out, corpus_tokens);
+            }
+        }
+    }
+    catch (const std::exception& e) {
+        std::cerr << "Error: " << e.what() << std::endl;
+        return 1;
+    }
+    return 0;
+}
 
+//   ,      
+bool isCompiledDictionaryFresh(const std::string& compiled_filename, const std::string& text_filename) {
+    std::error_code error;
+    if (!std::filesystem::exists(compiled_filename, error)) {
+        return false;
+    }
+    if (!std::filesystem::exists(text_filename, error)) {
+        return true;
+    }
+    return std::filesystem::last_write_time(compiled_filename, error) >= std::filesystem::last_write_time(text_filename, error);
+}
 
-int main() {
+int main(int argc, char* argv[]) {
+    if (argc > 1 && std::string(argv[1]) == "--bench") {
+        return runBenchmark(argc, argv);
+    }
     system("color F0");
     const int MAX_UNDO = 10;
+    bool ignore_case = false;
 
     SynonymDictionary dict;
-    UndoManager undoManager;
+    UndoManager undoManager(dict, MAX_UNDO);
+    std::unique_ptr<DictionaryJournal> journal;
 
     try {
-        dict.loadFromFile("synonyms.txt");
+        if (isCompiledDictionaryFresh("synonyms.dict", "synonyms.txt")) {
+            dict.loadFromFile("synonyms.dict");
+        }
+        else {
+            dict.loadFromFile("synonyms.txt");
+        }
+        //  ,     
+        journal = std::make_unique<DictionaryJournal>("synonyms.txt", "synonyms.dict", "synonyms.journal");
+        journal->replay(dict);
     }
     catch (const std::runtime_error& e) {
         std::cerr << "Error: " << e.what() << std::endl;
@@ -283,6 +2371,8 @@ int main() {
         std::cout << "4. Add a new canonical word with synonyms" << std::endl;
         std::cout << "5. Undo last action" << std::endl;
         std::cout << "6. Save and exit" << std::endl;
+        std::cout << "7. Compile dictionary" << std::endl;
+        std::cout << "8. Toggle case-insensitive matching (now " << (ignore_case ? "on" : "off") << ")" << std::endl;
 
         int choice;
         std::cout << "Enter option: ";
@@ -298,16 +2388,16 @@ int main() {
         try {
             switch (choice) {
             case 1:
-                processText(true, dict, undoManager);
+                processText(false, dict, undoManager, *journal, ignore_case);
                 break;
             case 2:
-                processText(false, dict, undoManager);
+                processText(true, dict, undoManager, *journal, ignore_case);
                 break;
             case 3:
-                inputSynonym(dict, undoManager);
+                inputSynonym(dict, undoManager, *journal);
                 break;
             case 4:
-                addNewWord(dict, undoManager);
+                addNewWord(dict, undoManager, *journal);
                 break;
             case 5: {
                 int N;
@@ -317,12 +2407,21 @@ int main() {
                     std::cout << "Cannot undo more than " << MAX_UNDO << " actions." << std::endl;
                     N = MAX_UNDO;
                 }
-                undoManager.undoLastActions(N);
+                //      
+                journal->record(undoManager.undoLastActions(N));
+                journal->commit(dict);
                 break;
             }
             case 6:
-                dict.saveToFile("synonyms.txt");
+                journal->checkpoint(dict);
                 return 0;
+            case 7:
+                journal->compile(dict);
+                std::cout << "Dictionary compiled to synonyms.dict" << std::endl;
+                break;
+            case 8:
+                ignore_case = !ignore_case;
+                break;
             default:
                 std::cout << "Unknown option! Please try again." << std::endl;
                 break;
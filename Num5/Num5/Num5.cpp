@@ -1,16 +1,29 @@
-﻿#include <fstream>
-#include <string>
+﻿#include <string>
 #include <vector>
 #include <map>
-#include <sstream>
+#include <unordered_map>
 #include <algorithm>
 #include <iostream>
-#include <chrono>
 #include <ctime>
-#include <iomanip>
+#include <climits>
+#include <string_view>
+#include <charconv>
+
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
 
 using namespace std;
 
+// Метка открытой даты окончания ("кон. нв"): договор действует по сей день
+const int OPEN_END = INT_MAX;
+
 struct Contract
 {
     string number;
@@ -18,6 +31,9 @@ struct Contract
     string endDate;
     string work;
     int cost;
+    int startDay;  // Номер дня начала (дни от 01.01.1970)
+    int endDay;    // Номер дня окончания или OPEN_END
+    int duration;  // Продолжительность в днях, для открытого договора - по сегодняшний день
 };
 
 struct Employee
@@ -29,61 +45,361 @@ struct Employee
 };
 
 map<string, Employee> employees; // Ассоциативный контейнер для хранения информации о сотрудниках 
+bool indexesStale = true;         // employees изменился после построения индексов договоров
+
+// Номер дня по григорианскому календарю (дни от 01.01.1970), только целочисленная арифметика
+int daysFromCivil(int year, int month, int day)
+{
+    year -= month <= 2;
+    int era = (year >= 0 ? year : year - 399) / 400;
+    int yearOfEra = year - era * 400;
+    int dayOfYear = (153 * (month + (month > 2 ? -3 : 9)) + 2) / 5 + day - 1;
+    int dayOfEra = yearOfEra * 365 + yearOfEra / 4 - yearOfEra / 100 + dayOfYear;
+    return era * 146097 + dayOfEra - 719468;
+}
+
+// Разбор даты вида ДД.ММ.ГГГГ в номер дня; false, если дата записана неверно
+bool parseDay(const string& date, int& dayNumber)
+{
+    if (date.size() != 10 || date[2] != '.' || date[5] != '.')
+    {
+        return false;
+    }
+    for (size_t i : { 0, 1, 3, 4, 6, 7, 8, 9 })
+    {
+        if (date[i] < '0' || date[i] > '9')
+        {
+            return false;
+        }
+    }
+    int day = (date[0] - '0') * 10 + (date[1] - '0');
+    int month = (date[3] - '0') * 10 + (date[4] - '0');
+    int year = ((date[6] - '0') * 10 + (date[7] - '0')) * 100 + (date[8] - '0') * 10 + (date[9] - '0');
+    static const int monthDays[] = { 31, 28, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31 };
+    bool leap = (year % 4 == 0 && year % 100 != 0) || year % 400 == 0;
+    if (month < 1 || month > 12 || day < 1 || day > monthDays[month - 1] + (month == 2 && leap))
+    {
+        return false;
+    }
+    dayNumber = daysFromCivil(year, month, day);
+    return true;
+}
+
+// Номер сегодняшнего дня по местному времени
+int today()
+{
+    time_t now = time(nullptr);
+    tm local = {};
+#ifdef _WIN32
+    localtime_s(&local, &now);
+#else
+    localtime_r(&now, &local);
+#endif
+    return daysFromCivil(local.tm_year + 1900, local.tm_mon + 1, local.tm_mday);
+}
+
+// Вычисляет номера дней и продолжительность договора один раз при загрузке
+bool computeDays(Contract& contract, int currentDay)
+{
+    if (!parseDay(contract.startDate, contract.startDay))
+    {
+        return false;
+    }
+    if (contract.endDate == "нв")
+    {
+        contract.endDay = OPEN_END;
+    }
+    else if (!parseDay(contract.endDate, contract.endDay))
+    {
+        return false;
+    }
+    contract.duration = (contract.endDay == OPEN_END ? currentDay : contract.endDay) - contract.startDay;
+    return true;
+}
+
+// Действует ли договор хотя бы один день из [firstDay, lastDay]
+bool isActiveDuring(const Contract& contract, int firstDay, int lastDay)
+{
+    return contract.startDay <= lastDay && firstDay <= contract.endDay;
+}
+
+// Файл, отображенный в память только для чтения
+class MappedFile
+{
+public:
+    MappedFile() = default;
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    ~MappedFile()
+    {
+        close();
+    }
+
+    bool open(const string& filename)
+    {
+        close();
+#ifdef _WIN32
+        file = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+            FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+        if (file == INVALID_HANDLE_VALUE)
+        {
+            return false;
+        }
+        LARGE_INTEGER size;
+        if (!GetFileSizeEx(file, &size))
+        {
+            close();
+            return false;
+        }
+        length = static_cast<size_t>(size.QuadPart);
+        if (length == 0)
+        {
+            return true;
+        }
+        mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        if (mapping != nullptr)
+        {
+            data = static_cast<const char*>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+        }
+        if (data == nullptr)
+        {
+            close();
+            return false;
+        }
+#else
+        int descriptor = ::open(filename.c_str(), O_RDONLY);
+        if (descriptor < 0)
+        {
+            return false;
+        }
+        struct stat info;
+        if (fstat(descriptor, &info) != 0)
+        {
+            ::close(descriptor);
+            return false;
+        }
+        length = static_cast<size_t>(info.st_size);
+        if (length > 0)
+        {
+            void* mapped = mmap(nullptr, length, PROT_READ, MAP_PRIVATE, descriptor, 0);
+            if (mapped == MAP_FAILED)
+            {
+                ::close(descriptor);
+                length = 0;
+                return false;
+            }
+            madvise(mapped, length, MADV_SEQUENTIAL);
+            data = static_cast<const char*>(mapped);
+        }
+        ::close(descriptor);
+#endif
+        return true;
+    }
+
+    string_view view() const
+    {
+        return string_view(data, length);
+    }
+
+private:
+    void close()
+    {
+#ifdef _WIN32
+        if (data != nullptr)
+        {
+            UnmapViewOfFile(data);
+        }
+        if (mapping != nullptr)
+        {
+            CloseHandle(mapping);
+        }
+        if (file != INVALID_HANDLE_VALUE)
+        {
+            CloseHandle(file);
+        }
+        mapping = nullptr;
+        file = INVALID_HANDLE_VALUE;
+#else
+        if (data != nullptr)
+        {
+            munmap(const_cast<char*>(data), length);
+        }
+#endif
+        data = nullptr;
+        length = 0;
+    }
+
+    const char* data = nullptr;
+    size_t length = 0;
+#ifdef _WIN32
+    HANDLE file = INVALID_HANDLE_VALUE;
+    HANDLE mapping = nullptr;
+#endif
+};
+
+// Делит строку на слова, разделенные пробелами и табуляцией; возвращает число слов
+// или maxTokens + 1, если слов больше, чем помещается в tokens
+size_t splitTokens(string_view line, string_view* tokens, size_t maxTokens)
+{
+    size_t count = 0;
+    size_t pos = 0;
+    while (true)
+    {
+        pos = line.find_first_not_of(" \t", pos);
+        if (pos == string_view::npos)
+        {
+            return count;
+        }
+        size_t end = line.find_first_of(" \t", pos);
+        if (end == string_view::npos)
+        {
+            end = line.size();
+        }
+        if (count == maxTokens)
+        {
+            return maxTokens + 1;
+        }
+        tokens[count++] = line.substr(pos, end - pos);
+        pos = end;
+    }
+}
+
+// Разбирает строку вида "Договор №1 нач. 01.01.2018 кон. 02.02.2018 Работа 123 Стоимость 12500;"
+bool parseContract(string_view line, int currentDay, Contract& contract)
+{
+    string_view tokens[10];
+    if (splitTokens(line, tokens, 10) != 10 || tokens[0] != "Договор" || tokens[2] != "нач."
+        || tokens[4] != "кон." || tokens[6] != "Работа" || tokens[8] != "Стоимость")
+    {
+        return false;
+    }
+    string_view cost = tokens[9];
+    if (!cost.empty() && cost.back() == ';')
+    {
+        cost.remove_suffix(1);
+    }
+    auto result = from_chars(cost.data(), cost.data() + cost.size(), contract.cost);
+    if (cost.empty() || result.ec != errc() || result.ptr != cost.data() + cost.size())
+    {
+        return false;
+    }
+    contract.number.assign(tokens[1].data(), tokens[1].size());
+    contract.startDate.assign(tokens[3].data(), tokens[3].size());
+    contract.endDate.assign(tokens[5].data(), tokens[5].size());
+    contract.work.assign(tokens[7].data(), tokens[7].size());
+    return computeDays(contract, currentDay);
+}
 
+// Однопроходный разбор реестра: файл отображается в память и делится на строки без копирования,
+// договоры и сотрудники перемещаются на место. Ошибочные строки и блоки пропускаются с указанием
+// номера строки
 void parseAndStoreData(const string& filename)
 {
-    ifstream file(filename);
-    if (!file.is_open())
+    MappedFile file;
+    if (!file.open(filename))
     {
         cout << "Failed to open the file: " << filename << endl;
         return;
     }
 
-    string line;
-    Employee currentEmployee;
+    string_view buffer = file.view();
+    if (buffer.substr(0, 3) == "\xEF\xBB\xBF")
+    {
+        buffer.remove_prefix(3);
+    }
+    size_t lineNumber = 0;
+    // Следующая строка файла без завершающего '\r'; false в конце файла
+    auto nextLine = [&](string_view& line)
+    {
+        if (buffer.empty())
+        {
+            return false;
+        }
+        size_t end = buffer.find('\n');
+        line = buffer.substr(0, end);
+        buffer.remove_prefix(end == string_view::npos ? buffer.size() : end + 1);
+        if (!line.empty() && line.back() == '\r')
+        {
+            line.remove_suffix(1);
+        }
+        ++lineNumber;
+        return true;
+    };
+    auto report = [&](size_t number, const char* message, string_view line)
+    {
+        cout << filename << ":" << number << ": " << message << ": " << line << "\n";
+    };
 
-    while (getline(file, line))
+    int currentDay = today();
+    string_view line;
+    vector<pair<string_view, size_t>> contractLines; // Строки договоров текущего блока и их номера
+    while (nextLine(line))
     {
-        if (line.empty()) continue;
+        if (line.find_first_not_of(" \t") == string_view::npos) continue;
 
         // Считываем ФИО сотрудника
-        stringstream ss(line);
-        ss >> currentEmployee.lastName >> currentEmployee.firstName >> currentEmployee.middleName;
-
-        // Считываем блок с информацией о договорах сотрудника
-        getline(file, line); // Пропускаем открывающую фигурную скобку
-        while (getline(file, line))
+        size_t headerNumber = lineNumber;
+        string_view name[3];
+        bool validName = splitTokens(line, name, 3) == 3;
+        if (!validName)
         {
-            if (line == "}") break; // Конец блока
+            report(headerNumber, "Invalid employee name", line);
+        }
 
-            // Считываем информацию о договоре
+        // Блок с договорами должен начинаться с "{" и заканчиваться "}". Без "{" следующая
+        // строка разбирается заново как ФИО
+        string_view header = line;
+        string_view rest = buffer;
+        if (!nextLine(line) || line != "{")
+        {
+            report(headerNumber, "Missing \"{\" after employee", header);
+            buffer = rest;
+            lineNumber = headerNumber;
+            continue;
+        }
+        contractLines.clear();
+        bool closed = false;
+        while (nextLine(line))
+        {
+            if (line == "}")
+            {
+                closed = true;
+                break;
+            }
+            contractLines.emplace_back(line, lineNumber);
+        }
+        if (!closed)
+        {
+            report(headerNumber, "Unterminated contract block of employee", header);
+            break;
+        }
+        if (!validName) continue;
+
+        Employee employee;
+        employee.lastName.assign(name[0].data(), name[0].size());
+        employee.firstName.assign(name[1].data(), name[1].size());
+        employee.middleName.assign(name[2].data(), name[2].size());
+        employee.contracts.reserve(contractLines.size());
+        for (const auto& contractLine : contractLines)
+        {
             Contract contract;
-            stringstream ss_contract(line);
-            string temp;
-            ss_contract >> temp; // Пропускаем "Договор"
-            ss_contract >> temp; // Считываем номер договора
-            contract.number = temp;
-            ss_contract >> temp; // Пропускаем "нач."
-            ss_contract >> contract.startDate;
-            ss_contract >> temp; // Пропускаем "кон."
-            ss_contract >> contract.endDate;
-            ss_contract >> temp; // Пропускаем "Работа"
-            ss_contract >> contract.work;
-            ss_contract >> temp; // Пропускаем "Стоимость"
-            ss_contract >> contract.cost;
-
-            currentEmployee.contracts.push_back(contract);
+            if (!parseContract(contractLine.first, currentDay, contract))
+            {
+                report(contractLine.second, "Invalid contract", contractLine.first);
+                continue;
+            }
+            employee.contracts.push_back(move(contract));
         }
 
         // Сохраняем данные о сотруднике
-        string key = currentEmployee.lastName + " " + currentEmployee.firstName + " " + currentEmployee.middleName;
-        employees[key] = currentEmployee;
-
-        // Очищаем данные для следующего сотрудника
-        currentEmployee = Employee();
+        string key;
+        key.reserve(name[0].size() + name[1].size() + name[2].size() + 2);
+        key.append(employee.lastName).append(" ").append(employee.firstName).append(" ").append(employee.middleName);
+        employees.insert_or_assign(move(key), move(employee));
+        indexesStale = true;
     }
-
-    file.close();
+    cout.flush();
 }
 
 // Функция для подсчета стоимости всех договоров сотрудника
@@ -97,41 +413,13 @@ int totalCostOfContracts(const Employee& employee)
     return totalCost;
 }
 
-// Функция для получения списка договоров сотрудника
-vector<Contract> contractsOfWork(const Employee& employee)
-{
-    return employee.contracts;
-}
-
-// Вспомогательная функция для конвертации строки в дату
-std::tm parseDate(const std::string& date)
-{
-    std::tm tm = {};
-    std::istringstream ss(date);
-    ss >> std::get_time(&tm, "%d.%m.%Y");
-    return tm;
-}
-
 // Функция для нахождения самого продолжительного договора сотрудника
 Contract longestContract(const Employee& employee)
 {
     auto longest = std::max_element(employee.contracts.begin(), employee.contracts.end(),
         [](const Contract& a, const Contract& b)
         {
-            std::tm startA = parseDate(a.startDate);
-            std::tm endA = parseDate(a.endDate);
-            std::tm startB = parseDate(b.startDate);
-            std::tm endB = parseDate(b.endDate);
-
-            auto startA_tp = std::chrono::system_clock::from_time_t(std::mktime(&startA));
-            auto endA_tp = std::chrono::system_clock::from_time_t(std::mktime(&endA));
-            auto startB_tp = std::chrono::system_clock::from_time_t(std::mktime(&startB));
-            auto endB_tp = std::chrono::system_clock::from_time_t(std::mktime(&endB));
-
-            auto durationA = endA_tp - startA_tp;
-            auto durationB = endB_tp - startB_tp;
-
-            return durationA < durationB;
+            return a.duration < b.duration;
         });
     std::string contractNumber = longest->number;
     contractNumber.replace(0, 3, "contract №");
@@ -158,7 +446,171 @@ Contract mostExpensiveContract(const Employee& employee)
 void removeEmployee(const string& lastName, const string& firstName, const string& middleName)
 {
     string key = lastName + " " + firstName + " " + middleName;
-    employees.erase(key);
+    if (employees.erase(key) != 0)
+    {
+        indexesStale = true;
+    }
+}
+
+// Договор в глобальных индексах вместе с его сотрудником. Указатели действительны, пока
+// employees не изменится; после изменения индексы перестраиваются при следующем запросе
+struct ContractRef
+{
+    const string* employee; // Ключ сотрудника "Фамилия Имя Отчество"
+    const Contract* contract;
+};
+
+// Глобальные вторичные индексы по всем договорам:
+// - byWork: код работы -> договоры этой работы, упорядоченные по стоимости;
+// - byCost: все договоры, упорядоченные по стоимости;
+// - byStart: дерево интервалов [startDay, endDay] в виде массива, упорядоченного по началу.
+//   Корень поддерева [lo, hi) - элемент mid = (lo + hi) / 2, maxEnd[mid] - наибольший конец
+//   в этом поддереве, что позволяет отбрасывать поддеревья, целиком закончившиеся раньше запроса
+struct ContractIndexes
+{
+    unordered_map<string, vector<ContractRef>> byWork;
+    vector<ContractRef> byCost;
+    vector<ContractRef> byStart;
+    vector<int> maxEnd;
+};
+
+ContractIndexes contractIndexes;
+
+bool cheaper(const ContractRef& a, const ContractRef& b)
+{
+    return a.contract->cost < b.contract->cost;
+}
+
+int buildMaxEnd(ContractIndexes& indexes, size_t lo, size_t hi)
+{
+    if (lo >= hi)
+    {
+        return INT_MIN;
+    }
+    size_t mid = (lo + hi) / 2;
+    int end = indexes.byStart[mid].contract->endDay;
+    end = max(end, buildMaxEnd(indexes, lo, mid));
+    end = max(end, buildMaxEnd(indexes, mid + 1, hi));
+    indexes.maxEnd[mid] = end;
+    return end;
+}
+
+// Индексы, перестроенные, если employees изменился с прошлого запроса
+const ContractIndexes& getIndexes()
+{
+    if (!indexesStale)
+    {
+        return contractIndexes;
+    }
+    ContractIndexes indexes;
+    for (const auto& pair : employees)
+    {
+        for (const auto& contract : pair.second.contracts)
+        {
+            ContractRef ref{ &pair.first, &contract };
+            indexes.byWork[contract.work].push_back(ref);
+            indexes.byCost.push_back(ref);
+        }
+    }
+    for (auto& work : indexes.byWork)
+    {
+        stable_sort(work.second.begin(), work.second.end(), cheaper);
+    }
+    indexes.byStart = indexes.byCost;
+    stable_sort(indexes.byCost.begin(), indexes.byCost.end(), cheaper);
+    stable_sort(indexes.byStart.begin(), indexes.byStart.end(), [](const ContractRef& a, const ContractRef& b)
+        {
+            return a.contract->startDay < b.contract->startDay;
+        });
+    indexes.maxEnd.resize(indexes.byStart.size());
+    buildMaxEnd(indexes, 0, indexes.byStart.size());
+
+    contractIndexes = move(indexes);
+    indexesStale = false;
+    return contractIndexes;
+}
+
+// Договоры из отрезка, упорядоченного по стоимости, со стоимостью в [minCost, maxCost]
+vector<ContractRef> costRange(const vector<ContractRef>& sorted, int minCost, int maxCost)
+{
+    auto first = lower_bound(sorted.begin(), sorted.end(), minCost, [](const ContractRef& ref, int cost)
+        {
+            return ref.contract->cost < cost;
+        });
+    auto last = upper_bound(first, sorted.end(), maxCost, [](int cost, const ContractRef& ref)
+        {
+            return cost < ref.contract->cost;
+        });
+    return vector<ContractRef>(first, last);
+}
+
+// Договоры по коду работы со стоимостью в [minCost, maxCost], по возрастанию стоимости
+vector<ContractRef> contractsByWork(const string& work, int minCost = INT_MIN, int maxCost = INT_MAX)
+{
+    const ContractIndexes& indexes = getIndexes();
+    auto it = indexes.byWork.find(work);
+    if (it == indexes.byWork.end())
+    {
+        return {};
+    }
+    return costRange(it->second, minCost, maxCost);
+}
+
+// Все договоры со стоимостью в [minCost, maxCost], по возрастанию стоимости
+vector<ContractRef> contractsByCost(int minCost, int maxCost)
+{
+    return costRange(getIndexes().byCost, minCost, maxCost);
+}
+
+void collectOverlapping(const ContractIndexes& indexes, size_t lo, size_t hi, int firstDay, int lastDay,
+    vector<ContractRef>& result)
+{
+    if (lo >= hi)
+    {
+        return;
+    }
+    size_t mid = (lo + hi) / 2;
+    if (indexes.maxEnd[mid] < firstDay)
+    {
+        return; // Все договоры поддерева закончились раньше
+    }
+    collectOverlapping(indexes, lo, mid, firstDay, lastDay, result);
+    const Contract& contract = *indexes.byStart[mid].contract;
+    if (contract.startDay > lastDay)
+    {
+        return; // Договоры правее начинаются еще позже
+    }
+    if (isActiveDuring(contract, firstDay, lastDay))
+    {
+        result.push_back(indexes.byStart[mid]);
+    }
+    collectOverlapping(indexes, mid + 1, hi, firstDay, lastDay, result);
+}
+
+// Договоры, действовавшие хотя бы один день из [firstDay, lastDay], по дате начала
+vector<ContractRef> contractsOverlapping(int firstDay, int lastDay)
+{
+    const ContractIndexes& indexes = getIndexes();
+    vector<ContractRef> result;
+    collectOverlapping(indexes, 0, indexes.byStart.size(), firstDay, lastDay, result);
+    return result;
+}
+
+// Договоры, действующие в указанный день, по дате начала
+vector<ContractRef> contractsActiveOn(int day)
+{
+    return contractsOverlapping(day, day);
+}
+
+void printContractRefs(const vector<ContractRef>& refs)
+{
+    for (const auto& ref : refs)
+    {
+        // Заменяем "тДЦ" на "contract №"
+        string contractNumber = ref.contract->number;
+        contractNumber.replace(0, 3, "contract №");
+        cout << *ref.employee << ": " << contractNumber << " - " << ref.contract->cost << endl;
+    }
 }
 
 void printEmployees() {
@@ -194,7 +646,7 @@ int main()
         cout << "Total cost of contracts: " << totalCostOfContracts(selectedEmployee) << endl;
 
         cout << "Contracts:" << endl;
-        for (const auto& contract : contractsOfWork(selectedEmployee))
+        for (const auto& contract : selectedEmployee.contracts)
         {
             // Заменяем "тДЦ" на "contract №"
             string contractNumber = contract.number;
@@ -212,6 +664,17 @@ int main()
         cout << "Employee not found." << endl;
     }
 
+    // Запросы по глобальным индексам договоров
+    int day;
+    if (parseDay("01.03.2018", day))
+    {
+        cout << "Contracts active on 01.03.2018:" << endl;
+        printContractRefs(contractsActiveOn(day));
+    }
+    cout << "Contracts for work 1234 costing over 1000:" << endl;
+    printContractRefs(contractsByWork("1234", 1001));
+    cout << endl;
+
     cout << "After remove:" << endl;
     removeEmployee("Ivanov", "Ivan", "Ivanovich");
     printEmployees();